@@ -0,0 +1,132 @@
+#include "async_lookup.h"
+#include "common/connection_pool.h"
+
+namespace chord {
+
+bool PendingLookup::complete(const LookupResult& result) {
+    if (finished_.exchange(true)) {
+        return false;
+    }
+    std::shared_ptr<Channel> channel;
+    uint64_t call;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channel.swap(channel_);
+        call = call_;
+    }
+    if (channel != nullptr && result.status != LookupStatus::kOk) {
+        channel->cancel(call);
+    }
+    done_(result);
+    return true;
+}
+
+void PendingLookup::inflight(const std::shared_ptr<Channel>& channel, uint64_t call) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channel_ = channel;
+        call_    = call;
+    }
+    // completed while the call was being sent
+    if (finished_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (channel_ != nullptr) {
+            channel_->cancel(call_);
+            channel_.reset();
+        }
+    }
+}
+
+LookupLoop& LookupLoop::Instance() {
+    static LookupLoop loop;
+    return loop;
+}
+
+LookupLoop::LookupLoop() : connectors_(kLookupConnectThreads) {
+    thread_ = std::thread(&LookupLoop::run, this);
+    thread_.detach();
+}
+
+void LookupLoop::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void LookupLoop::expire(const std::shared_ptr<PendingLookup>& lookup) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        deadlines_.push(Deadline(lookup->deadline(), lookup));
+    }
+    cv_.notify_one();
+}
+
+void LookupLoop::connect(const struct sockaddr_in& addr, ConnectCallback done) {
+    uint64_t key = peer_key(addr);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& waiting = connecting_[key];
+        waiting.push_back(std::move(done));
+        if (waiting.size() > 1) {
+            return;
+        }
+    }
+    connectors_.AddTask([this, addr, key] {
+        bool reused                      = false;
+        std::shared_ptr<Channel> channel = ConnectionPool::Instance().acquire(addr, &reused);
+        post([this, key, channel, reused] {
+            std::vector<ConnectCallback> waiting;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiting.swap(connecting_[key]);
+                connecting_.erase(key);
+            }
+            for (auto& done : waiting) {
+                done(channel, reused);
+            }
+        });
+    });
+}
+
+void LookupLoop::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (1) {
+        if (tasks_.empty()) {
+            if (deadlines_.empty()) {
+                cv_.wait(lock);
+            } else {
+                // a copy, the heap may grow while the lock is released
+                auto deadline = deadlines_.top().first;
+                cv_.wait_until(lock, deadline);
+            }
+        }
+
+        std::vector<std::shared_ptr<PendingLookup>> expired;
+        auto now = PendingLookup::Clock::now();
+        while (!deadlines_.empty() && deadlines_.top().first <= now) {
+            // lookups that finished in time are gone already
+            auto lookup = deadlines_.top().second.lock();
+            if (lookup != nullptr) {
+                expired.push_back(lookup);
+            }
+            deadlines_.pop();
+        }
+        std::deque<std::function<void()>> tasks;
+        tasks.swap(tasks_);
+
+        lock.unlock();
+        for (auto& lookup : expired) {
+            lookup->complete(LookupResult{LookupStatus::kTimedOut, NodeRef()});
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+        expired.clear();
+        tasks.clear();
+        lock.lock();
+    }
+}
+
+}  // namespace chord
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common/channel.h"
+#include "common/node_ref.h"
+#include "common/thread_pool.h"
+
+namespace chord {
+
+/*! \brief an asynchronous lookup without a deadline of its own gives up after this long. */
+const int32_t kLookupTimeoutMs = 10000;
+
+enum class LookupStatus { kOk, kCancelled, kTimedOut, kFailed };
+
+struct LookupResult
+{
+    LookupStatus status;
+    NodeRef owner;  // valid if status is kOk
+};
+
+typedef std::function<void(const LookupResult& result)> LookupCallback;
+
+/**
+ * \brief  a lookup in flight, shared by its caller, the RPC in flight and
+ *         the deadline. Whichever of a reply, a failure, cancel() and the
+ *         deadline comes first completes it, the others find it finished.
+ */
+class PendingLookup {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    PendingLookup(const NodeId& id, LookupCallback done, Clock::time_point deadline)
+        : id_(id), done_(std::move(done)), deadline_(deadline), finished_(false), call_(0) {}
+
+    const NodeId& id() const { return id_; }
+    Clock::time_point deadline() const { return deadline_; }
+    bool finished() const { return finished_; }
+
+    /*! \brief completes the lookup as cancelled, unless it finished already. */
+    bool cancel() { return complete(LookupResult{LookupStatus::kCancelled, NodeRef()}); }
+
+    /**
+     * \brief  runs done with result and abandons the RPC in flight, unless
+     *         the lookup finished already.
+     * \return true if this call completed it.
+     */
+    bool complete(const LookupResult& result);
+
+    /*! \brief remembers the RPC in flight, so that completing the lookup abandons it. */
+    void inflight(const std::shared_ptr<Channel>& channel, uint64_t call);
+
+   private:
+    NodeId id_;
+    LookupCallback done_;
+    Clock::time_point deadline_;
+    std::atomic<bool> finished_;
+
+    std::mutex mutex_;
+    std::shared_ptr<Channel> channel_;
+    uint64_t call_;
+};
+
+/*! \brief threads that connect to next hops for asynchronous lookups. */
+const int kLookupConnectThreads = 4;
+
+/**
+ * \brief  the thread that drives asynchronous lookups: it runs the steps
+ *         posted by RPC completions, which must not run on the reader thread
+ *         of a channel, and times lookups out at their deadlines. It never
+ *         blocks on the network, connecting to a peer happens on threads of
+ *         its own.
+ */
+class LookupLoop {
+   public:
+    static LookupLoop& Instance();
+
+    void post(std::function<void()> task);
+
+    /*! \brief completes lookup as timed out at its deadline, unless it finished before. */
+    void expire(const std::shared_ptr<PendingLookup>& lookup);
+
+    typedef std::function<void(const std::shared_ptr<Channel>& channel, bool reused)> ConnectCallback;
+
+    /**
+     * \brief  ConnectionPool::acquire() off the loop, then done(channel,
+     *         reused) on it. channel is nullptr if the peer cannot be reached.
+     *         Lookups waiting on the same peer share one attempt.
+     */
+    void connect(const struct sockaddr_in& addr, ConnectCallback done);
+
+    LookupLoop(const LookupLoop&) = delete;
+    LookupLoop& operator=(const LookupLoop&) = delete;
+
+   private:
+    LookupLoop();
+
+    void run();
+
+    typedef std::pair<PendingLookup::Clock::time_point, std::weak_ptr<PendingLookup>> Deadline;
+    struct Later
+    {
+        bool operator()(const Deadline& a, const Deadline& b) const { return a.first > b.first; }
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::priority_queue<Deadline, std::vector<Deadline>, Later> deadlines_;
+    std::thread thread_;
+    threadpool connectors_;
+    // callbacks waiting for the connect in progress to a peer, by peer_key()
+    std::unordered_map<uint64_t, std::vector<ConnectCallback>> connecting_;
+};
+
+}  // namespace chord
@@ -0,0 +1,185 @@
+// Compares the limb based ring arithmetic of common/bigint.cc with the byte
+// loops it replaced, and checks that both agree on random ids first.
+//
+//   ./bigint_bench [iterations]
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "common/bigint.h"
+
+namespace legacy {
+
+void add(const uint8_t *a, uint8_t *b) {
+    int8_t index = 0, overflow = 0;
+    for (index = BYTES - 1; index > -1; index--) {
+        uint16_t sum = a[index] + b[index] + overflow;
+        overflow     = sum > UCHAR_MAX ? 1 : 0;
+        b[index]     = sum & 0xff;
+    }
+}
+
+bool within(const void *value, const void *lower, const void *upper) {
+    int lowupp = compare(lower, upper);
+    int lowcmp = compare(lower, value), upcmp = compare(value, upper);
+    int lowlim = 0, uplim = 1;
+
+    if (lowupp < 0)
+        return lowcmp < lowlim && upcmp < uplim;
+    else if (lowupp > 0)
+        return lowcmp < lowlim || upcmp < uplim;
+    else
+        return lowcmp != 0;
+}
+
+}  // namespace legacy
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t kIds       = 4096;
+const size_t kIntervals = 160;
+
+struct Id
+{
+    uint8_t b[BYTES];
+};
+
+double elapsed_ns(Clock::time_point start, size_t ops) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+
+    // random ids, with some bounds repeated so that equal and empty cases occur
+    std::mt19937_64 rng(42);
+    std::vector<Id> ids(kIds);
+    for (auto &id : ids) {
+        for (auto &b : id.b) {
+            b = rng();
+        }
+    }
+    for (size_t i = 0; i < kIds; i += 16) {
+        ids[i] = ids[(i * 7) % kIds];
+    }
+
+    // agreement first
+    size_t checked = 0;
+    for (size_t i = 0; i + 2 < kIds; ++i) {
+        const Id &v = ids[i], &l = ids[i + 1], &u = ids[(i * 13) % kIds];
+        if (chord::within(v.b, l.b, u.b) != legacy::within(v.b, l.b, u.b) ||
+            chord::within(l.b, l.b, u.b) != legacy::within(l.b, l.b, u.b) ||
+            chord::within(u.b, l.b, u.b) != legacy::within(u.b, l.b, u.b)) {
+            fprintf(stderr, "within() disagrees at %zu\n", i);
+            return 1;
+        }
+        Id x = u, y = u;
+        chord::add(v.b, x.b);
+        legacy::add(v.b, y.b);
+        if (memcmp(x.b, y.b, BYTES) != 0) {
+            fprintf(stderr, "add() disagrees at %zu\n", i);
+            return 1;
+        }
+        checked += 4;
+    }
+
+    chord::IntervalSet set;
+    for (size_t k = 0; k < kIntervals; ++k) {
+        set.push(ids[k].b, ids[k + 1].b);
+    }
+    bool hits[kIntervals];
+    for (size_t i = 0; i < kIds; ++i) {
+        set.within(ids[i].b, hits);
+        for (size_t k = 0; k < kIntervals; ++k) {
+            if (hits[k] != legacy::within(ids[i].b, ids[k].b, ids[k + 1].b)) {
+                fprintf(stderr, "IntervalSet disagrees at %zu/%zu\n", i, k);
+                return 1;
+            }
+        }
+        checked += kIntervals;
+    }
+    printf("%zu results agree\n\n", checked);
+
+    // timings, the sink keeps the compiler from dropping the loops
+    volatile size_t sink = 0;
+    Clock::time_point start;
+    size_t n;
+
+    start = Clock::now();
+    n     = 0;
+    for (size_t it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i + 2 < kIds; ++i) {
+            n += legacy::within(ids[i].b, ids[i + 1].b, ids[i + 2].b);
+        }
+    }
+    double within_bytes = elapsed_ns(start, iterations * (kIds - 2));
+    sink                = sink + n;
+
+    start = Clock::now();
+    n     = 0;
+    for (size_t it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i + 2 < kIds; ++i) {
+            n += chord::within(ids[i].b, ids[i + 1].b, ids[i + 2].b);
+        }
+    }
+    double within_limbs = elapsed_ns(start, iterations * (kIds - 2));
+    sink                = sink + n;
+
+    Id acc = ids[0];
+    start  = Clock::now();
+    for (size_t it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i < kIds; ++i) {
+            legacy::add(ids[i].b, acc.b);
+        }
+    }
+    double add_bytes = elapsed_ns(start, iterations * kIds);
+    sink             = sink + acc.b[0];
+
+    start = Clock::now();
+    for (size_t it = 0; it < iterations; ++it) {
+        for (size_t i = 0; i < kIds; ++i) {
+            chord::add(ids[i].b, acc.b);
+        }
+    }
+    double add_limbs = elapsed_ns(start, iterations * kIds);
+    sink             = sink + acc.b[0];
+
+    // one value against kIntervals intervals, as when scanning a finger table
+    size_t rounds = iterations * kIds / kIntervals;
+    start         = Clock::now();
+    n             = 0;
+    for (size_t it = 0; it < rounds; ++it) {
+        const Id &v = ids[it % kIds];
+        for (size_t k = 0; k < kIntervals; ++k) {
+            n += legacy::within(v.b, ids[k].b, ids[k + 1].b);
+        }
+    }
+    double scan_bytes = elapsed_ns(start, rounds * kIntervals);
+    sink              = sink + n;
+
+    start = Clock::now();
+    n     = 0;
+    for (size_t it = 0; it < rounds; ++it) {
+        set.within(ids[it % kIds].b, hits);
+        n += hits[it % kIntervals];
+    }
+    double scan_batch = elapsed_ns(start, rounds * kIntervals);
+    sink              = sink + n;
+
+    printf("%-28s %10s %10s %8s\n", "operation", "bytes", "limbs", "speedup");
+    printf("%-28s %8.2fns %8.2fns %7.1fx\n", "within", within_bytes, within_limbs, within_bytes / within_limbs);
+    printf("%-28s %8.2fns %8.2fns %7.1fx\n", "add", add_bytes, add_limbs, add_bytes / add_limbs);
+    printf("%-28s %8.2fns %8.2fns %7.1fx\n", "within, 160 intervals batched", scan_bytes, scan_batch,
+           scan_bytes / scan_batch);
+    return sink == 0xdeadbeef;
+}
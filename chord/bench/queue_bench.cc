@@ -0,0 +1,240 @@
+// Measures the lock-free SyncQueue ring of common/thread_pool.h against the
+// queue it replaced, a std::list under one mutex, in two ways:
+//
+//  - queue: P producers put integers into the queue and P consumers take
+//    them out, the time is taken until the last one was taken.
+//  - pool: P producers add tasks shaped like those of rpc_daemon to a pool
+//    of W workers, and the time is taken until the last one ran. This is
+//    threadpool, work-stealing deques fed by the ring and carrying Callable
+//    by value, against workers taking std::function from the list.
+//
+// Both sides hold capacity items, rounded up to the power of two the ring
+// is built with.
+//
+//   ./queue_bench [items] [workers] [capacity]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/thread_pool.h"
+
+namespace legacy {
+
+template <typename T>
+class SyncQueue {
+   public:
+    SyncQueue(int maxSize) : maxSize_(maxSize), needStop_(false) {}
+
+    void Put(T&& x) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]() { return needStop_ || queue_.size() < maxSize_; });
+        if (needStop_) return;
+        queue_.push_back(std::forward<T>(x));
+        notEmpty_.notify_one();
+    }
+
+    void Take(T& t) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return needStop_ || !queue_.empty(); });
+        if (needStop_) return;
+        t = queue_.front();
+        queue_.pop_front();
+        notFull_.notify_one();
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            needStop_ = true;
+        }
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+
+   private:
+    std::list<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    size_t maxSize_;
+    bool needStop_;
+};
+
+class threadpool {
+   public:
+    using Task = std::function<void()>;
+
+    threadpool(int numThreads, int capacity) : queue_(capacity), running_(true) {
+        for (int i = 0; i < numThreads; ++i) {
+            group_.emplace_back(&threadpool::RunInThread, this);
+        }
+    }
+
+    ~threadpool() {
+        running_ = false;
+        queue_.Stop();
+        for (auto& thread : group_) {
+            thread.join();
+        }
+    }
+
+    void AddTask(Task&& task) { queue_.Put(std::forward<Task>(task)); }
+
+   private:
+    void RunInThread() {
+        while (running_) {
+            Task task;
+            queue_.Take(task);
+            if (!running_) return;
+            task();
+        }
+    }
+
+    SyncQueue<Task> queue_;
+    std::atomic_bool running_;
+    std::vector<std::thread> group_;
+};
+
+}  // namespace legacy
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// what rpc_daemon queues: a session, a frame and the registry
+struct Session
+{
+    std::atomic<uint64_t> served{0};
+    std::atomic<uint64_t> done{0};
+};
+
+template <typename Queue>
+double run_queue(Queue* queue, size_t items, int pairs, std::atomic<uint64_t>* sink) {
+    size_t per_thread       = items / pairs;
+    Clock::time_point start = Clock::now();
+
+    std::vector<std::thread> group;
+    for (int p = 0; p < pairs; ++p) {
+        group.emplace_back([queue, per_thread] {
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t item = i;
+                queue->Put(std::move(item));
+            }
+        });
+        group.emplace_back([queue, per_thread, sink] {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t item = 0;
+                queue->Take(item);
+                sum += item;
+            }
+            *sink += sum;
+        });
+    }
+    for (auto& thread : group) {
+        thread.join();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (per_thread * pairs);
+}
+
+template <typename Pool>
+double run(Pool* pool, size_t items, int producers, std::atomic<uint64_t>* sink) {
+    auto session            = std::make_shared<Session>();
+    size_t per_thread       = items / producers;
+    Clock::time_point start = Clock::now();
+
+    std::vector<std::thread> group;
+    for (int p = 0; p < producers; ++p) {
+        group.emplace_back([pool, &session, per_thread, p] {
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t frame = i, version = p;
+                const void* registry = pool;
+                pool->AddTask([session, frame, version, registry] {
+                    session->served += frame + version;
+                    ++session->done;
+                });
+            }
+        });
+    }
+    for (auto& thread : group) {
+        thread.join();
+    }
+    while (session->done < per_thread * producers) {
+        std::this_thread::yield();
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (per_thread * producers);
+    *sink += session->served;
+    return ns;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t items = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    int workers  = argc > 2 ? atoi(argv[2]) : 4;
+    int capacity = argc > 3 ? atoi(argv[3]) : chord::kInjectQueueSize;
+    int rounded  = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+    capacity = rounded;
+
+    // every item must be taken and every task run exactly once
+    std::atomic<uint64_t> sink(0);
+    uint64_t expected = 0;
+    for (int producers : {1, 2, 4, 8}) {
+        size_t per_thread = items / producers;
+        expected += 2 * per_thread * (per_thread - 1) / 2 * producers;
+        expected += 2 * (per_thread * (per_thread - 1) / 2 * producers + per_thread * (producers * (producers - 1) / 2));
+    }
+
+    printf("%zu items, %d workers, capacity %d, %u cpus\n", items, workers, capacity,
+           std::thread::hardware_concurrency());
+
+    printf("\nqueue: P producers, P consumers\n");
+    printf("%-10s %12s %12s %8s\n", "producers", "list+mutex", "ring", "speedup");
+    for (int producers : {1, 2, 4, 8}) {
+        double list, ring;
+        {
+            legacy::SyncQueue<uint64_t> queue(capacity);
+            list = run_queue(&queue, items, producers, &sink);
+        }
+        {
+            chord::SyncQueue<uint64_t> queue(capacity);
+            ring = run_queue(&queue, items, producers, &sink);
+        }
+        printf("%10d %10.1fns %10.1fns %7.1fx\n", producers, list, ring, list / ring);
+    }
+
+    printf("\npool: P producers, %d workers\n", workers);
+    printf("%-10s %12s %12s %8s\n", "producers", "list+mutex", "stealing", "speedup");
+    for (int producers : {1, 2, 4, 8}) {
+        double list, stealing;
+        {
+            legacy::threadpool pool(workers, capacity);
+            list = run(&pool, items, producers, &sink);
+        }
+        {
+            chord::threadpool pool(workers, capacity);
+            stealing = run(&pool, items, producers, &sink);
+        }
+        printf("%10d %10.1fns %10.1fns %7.1fx\n", producers, list, stealing, list / stealing);
+    }
+
+    if (sink != expected) {
+        fprintf(stderr, "items lost or duplicated: %llu != %llu\n", (unsigned long long)sink.load(),
+                (unsigned long long)expected);
+        return 1;
+    }
+    return 0;
+}
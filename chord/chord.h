@@ -12,7 +12,8 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "proto/chord.pb.h"
 
-#define MAX_TCP_CONNECTIONS 40
+#define MAX_TCP_CONNECTIONS SOMAXCONN
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+namespace chord {
+
+/**
+ * \brief  the period of a maintenance task that adapts to churn. It starts
+ *         at min, doubles after every round that found nothing changed, up to
+ *         max, and drops back to min as soon as anything signals churn. With
+ *         min equal to max it is a fixed period.
+ * \note   thread-safe.
+ */
+class AdaptiveInterval {
+   public:
+    typedef std::function<void(int32_t interval_ms)> Listener;
+
+    AdaptiveInterval() : min_(0), max_(0), current_(0) {}
+
+    void setBounds(int32_t min_ms, int32_t max_ms) {
+        min_     = min_ms;
+        max_     = max_ms;
+        current_ = min_ms;
+    }
+
+    /*! \brief listener is told the new period whenever it changes. */
+    void setListener(Listener listener) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listener_ = std::move(listener);
+    }
+
+    int32_t current() const { return current_; }
+    int32_t min() const { return min_; }
+    int32_t max() const { return max_; }
+
+    /*! \brief a round found the ring as it was, the next one may wait longer. */
+    void stable() {
+        int32_t current = current_;
+        int32_t next;
+        do {
+            next = std::min<int64_t>(int64_t(current) * 2, max_);
+        } while (!current_.compare_exchange_weak(current, next));
+        if (next != current) {
+            changed();
+        }
+    }
+
+    /*! \brief the ring changed, the next round comes soon. */
+    void churn() {
+        if (current_.exchange(min_) != min_) {
+            changed();
+        }
+    }
+
+   private:
+    void changed() {
+        // the period as of now, so the last listener call of racing changes is never stale
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (listener_) {
+            listener_(current_);
+        }
+    }
+
+    int32_t min_;
+    int32_t max_;
+    std::atomic<int32_t> current_;
+
+    std::mutex mutex_;
+    Listener listener_;
+};
+
+}  // namespace chord
@@ -1,3 +1,4 @@
+#include <endian.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,16 +8,75 @@
 
 namespace chord {
 
-uint8_t ZERO[BYTES] = {0};
-uint8_t ONE[BYTES]  = {[BYTES - 1] = 1};
+namespace {
+
+// an id as a 32-bit high part and a 128-bit low part, loaded big-endian
+struct U160
+{
+    uint32_t hi;
+    unsigned __int128 lo;
+};
+
+inline uint32_t load_be32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return be32toh(v);
+}
+
+inline uint64_t load_be64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return be64toh(v);
+}
+
+inline void store_be32(uint8_t *p, uint32_t v) {
+    v = htobe32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+inline void store_be64(uint8_t *p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+inline U160 load(const void *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    U160 v;
+    v.hi = load_be32(b);
+    v.lo = ((unsigned __int128)load_be64(b + 4) << 64) | load_be64(b + 12);
+    return v;
+}
+
+inline void store(uint8_t *b, const U160 &v) {
+    store_be32(b, v.hi);
+    store_be64(b + 4, (uint64_t)(v.lo >> 64));
+    store_be64(b + 12, (uint64_t)v.lo);
+}
+
+// a - b modulo 2^160
+inline U160 sub(const U160 &a, const U160 &b) {
+    U160 d;
+    d.lo = a.lo - b.lo;
+    d.hi = a.hi - b.hi - (a.lo < b.lo);
+    return d;
+}
+
+}  // namespace
 
 void add(const uint8_t *a, uint8_t *b) {
-    int8_t index = 0, overflow = 0;
-    for (index = BYTES - 1; index > -1; index--) {
-        uint16_t sum = a[index] + b[index] + overflow;
-        overflow     = sum > UCHAR_MAX ? 1 : 0;
-        b[index]     = sum & 0xff;
-    }
+    U160 x = load(a), y = load(b);
+    U160 sum;
+    sum.lo = x.lo + y.lo;
+    sum.hi = x.hi + y.hi + (sum.lo < x.lo);
+    store(b, sum);
+}
+
+void sub(const uint8_t *a, uint8_t *b) {
+    U160 x = load(a), y = load(b);
+    U160 diff;
+    diff.lo = y.lo - x.lo;
+    diff.hi = y.hi - x.hi - (y.lo < x.lo);
+    store(b, diff);
 }
 
 void pow2(uint8_t exponent, uint8_t *dest) {
@@ -24,17 +84,17 @@ void pow2(uint8_t exponent, uint8_t *dest) {
     dest[BYTES - (exponent / 8) - 1] = 1 << (exponent % 8);
 }
 
+// value lies in (lower, upper] iff value - lower is in (0, upper - lower],
+// all modulo 2^160; lower == upper is the whole ring except lower.
 bool within(const void *value, const void *lower, const void *upper) {
-    int lowupp = compare(lower, upper);
-    int lowcmp = compare(lower, value), upcmp = compare(value, upper);
-    int lowlim = 0, uplim = 1;
+    U160 l = load(lower);
+    U160 d = sub(load(value), l);
+    U160 w = sub(load(upper), l);
 
-    if (lowupp < 0)
-        return lowcmp < lowlim && upcmp < uplim;
-    else if (lowupp > 0)
-        return lowcmp < lowlim || upcmp < uplim;
-    else
-        return lowcmp != 0;
+    bool d_zero = (d.hi == 0) & (d.lo == 0);
+    bool w_zero = (w.hi == 0) & (w.lo == 0);
+    bool d_le_w = (d.hi < w.hi) | ((d.hi == w.hi) & (d.lo <= w.lo));
+    return (!d_zero) & (w_zero | d_le_w);
 }
 
 void print(const uint8_t *a) {
@@ -46,4 +106,86 @@ void sprint(char *dest, const uint8_t *a) {
     int index;
     for (index = 0; index < BYTES; index++) sprintf(dest + 2 * index, "%02x", a[index]);
 }
-}  // namespace chord
\ No newline at end of file
+
+namespace {
+
+// lanes per vector, the limb arrays are padded to a multiple of it
+const size_t kLanes = 4;
+
+typedef uint64_t u64x4 __attribute__((vector_size(kLanes * sizeof(uint64_t))));
+typedef int64_t m64x4 __attribute__((vector_size(kLanes * sizeof(uint64_t))));
+// the limb arrays are only 8-byte aligned
+typedef uint64_t u64x4_unaligned __attribute__((vector_size(kLanes * sizeof(uint64_t)), aligned(8), may_alias));
+
+#define load_lanes(p) (*(const u64x4_unaligned *)(p))
+
+void split(const U160 &v, uint64_t *limbs) {
+    limbs[0] = v.hi;
+    limbs[1] = (uint64_t)(v.lo >> 64);
+    limbs[2] = (uint64_t)v.lo;
+}
+
+}  // namespace
+
+void IntervalSet::clear() {
+    for (int k = 0; k < 3; ++k) {
+        base_[k].clear();
+        width_[k].clear();
+    }
+    size_ = 0;
+}
+
+void IntervalSet::push(const void *lower, const void *upper) {
+    U160 l = load(lower);
+    uint64_t base[3], width[3];
+    split(l, base);
+    split(sub(load(upper), l), width);
+
+    // the padding lanes hold width 0, which stands for the whole ring and
+    // matches everything, within() drops the lanes past size_
+    if (size_ % kLanes == 0) {
+        for (int k = 0; k < 3; ++k) {
+            base_[k].resize(size_ + kLanes, 0);
+            width_[k].resize(size_ + kLanes, 0);
+        }
+    }
+    for (int k = 0; k < 3; ++k) {
+        base_[k][size_]  = base[k];
+        width_[k][size_] = width[k];
+    }
+    ++size_;
+}
+
+// compiled for AVX2 as well where the toolchain can pick the best clone at load time
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+void IntervalSet::within(const void *value, bool *out) const {
+    uint64_t v[3];
+    split(load(value), v);
+    const uint64_t kHiMask = 0xffffffffULL;
+
+    for (size_t i = 0; i < size_; i += kLanes) {
+        u64x4 b0 = load_lanes(&base_[0][i]), b1 = load_lanes(&base_[1][i]), b2 = load_lanes(&base_[2][i]);
+        u64x4 w0 = load_lanes(&width_[0][i]), w1 = load_lanes(&width_[1][i]), w2 = load_lanes(&width_[2][i]);
+
+        // d = value - base, borrows are all-ones masks, so adding one subtracts 1
+        u64x4 d2       = v[2] - b2;
+        m64x4 borrow2  = v[2] < b2;
+        u64x4 d1       = v[1] - b1 + (u64x4)borrow2;
+        m64x4 borrow1  = (v[1] < b1) | ((v[1] == b1) & borrow2);
+        u64x4 d0       = (v[0] - b0 + (u64x4)borrow1) & kHiMask;
+
+        m64x4 d_zero = (d0 == 0) & (d1 == 0) & (d2 == 0);
+        m64x4 w_zero = (w0 == 0) & (w1 == 0) & (w2 == 0);
+        m64x4 d_le_w = (d0 < w0) | ((d0 == w0) & ((d1 < w1) | ((d1 == w1) & (d2 <= w2))));
+        m64x4 hit    = ~d_zero & (w_zero | d_le_w);
+
+        // the padding lanes past size_ hit as well, their results are not wanted
+        for (size_t k = 0; k < kLanes && i + k < size_; ++k) {
+            out[i + k] = hit[k] != 0;
+        }
+    }
+}
+
+}  // namespace chord
@@ -2,6 +2,10 @@
 
 #include <openssl/sha.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
 
 #ifndef BYTES
 #define BYTES SHA_DIGEST_LENGTH
@@ -11,8 +15,34 @@
 
 namespace chord {
 void add(const uint8_t *a, uint8_t *b);
+void sub(const uint8_t *a, uint8_t *b);
 void pow2(uint8_t a, uint8_t *b);
 bool within(const void *value, const void *lower, const void *upper);
 void print(const uint8_t *a);
 void sprint(char *dest, const uint8_t *a);
+
+/**
+ * \brief  many intervals (lower, upper] tested against one value at once.
+ *         Every interval is kept as its lower bound and its width, split into
+ *         64-bit limbs stored side by side, so that a test covers several
+ *         intervals per vector instruction.
+ */
+class IntervalSet {
+   public:
+    void clear();
+
+    /*! \brief appends (lower, upper], with the same meaning as within(). */
+    void push(const void *lower, const void *upper);
+
+    size_t size() const { return size_; }
+
+    /*! \brief sets out[i] to within(value, lower_i, upper_i) for every interval. */
+    void within(const void *value, bool *out) const;
+
+   private:
+    // limbs, most significant first: bytes 0-3, 4-11 and 12-19 of an id
+    std::vector<uint64_t> base_[3];
+    std::vector<uint64_t> width_[3];
+    size_t size_ = 0;
+};
 }  // namespace chord
@@ -0,0 +1,48 @@
+#include "buffer_pool.h"
+
+namespace chord {
+
+namespace {
+// bounds what an idle pool holds on to, larger buffers are freed
+const size_t kMaxPooled      = 1024;
+const size_t kMaxPooledBytes = 64 * 1024;
+}  // namespace
+
+void BufferPool::Release::operator()(std::string* buf) const { BufferPool::Instance().release(buf); }
+
+BufferPool& BufferPool::Instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::~BufferPool() {
+    for (auto buf : free_) {
+        delete buf;
+    }
+}
+
+BufferPool::Buffer BufferPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            std::string* buf = free_.back();
+            free_.pop_back();
+            return Buffer(buf);
+        }
+    }
+    return Buffer(new std::string());
+}
+
+void BufferPool::release(std::string* buf) {
+    if (buf->capacity() <= kMaxPooledBytes) {
+        buf->clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < kMaxPooled) {
+            free_.push_back(buf);
+            return;
+        }
+    }
+    delete buf;
+}
+
+}  // namespace chord
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace chord {
+
+/**
+ * \brief  recycles the buffers frames are handed over in. A buffer keeps its
+ *         capacity between uses, so once the pool is warm a frame moves from
+ *         the reactor to a worker without touching the allocator.
+ */
+class BufferPool {
+   public:
+    /*! \brief gives a buffer back to the pool instead of freeing it. */
+    struct Release
+    {
+        void operator()(std::string* buf) const;
+    };
+    typedef std::unique_ptr<std::string, Release> Buffer;
+
+    static BufferPool& Instance();
+
+    /*! \brief returns an empty buffer, usually with capacity left from an earlier frame. */
+    Buffer acquire();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+   private:
+    BufferPool() {}
+    ~BufferPool();
+
+    void release(std::string* buf);
+
+    std::mutex mutex_;
+    std::vector<std::string*> free_;
+};
+
+}  // namespace chord
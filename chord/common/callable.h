@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace chord {
+
+/*! \brief bytes of state a Callable keeps inline, larger callables go to the heap. */
+const size_t kCallableInline = 48;
+
+/**
+ * \brief  a move-only void() callable. Unlike std::function it never copies,
+ *         so captures may be move-only, and it stores callables of up to
+ *         kCallableInline bytes in place, which covers the usual lambda
+ *         capturing a shared_ptr and a few pointers without an allocation.
+ */
+class Callable {
+   public:
+    Callable() : ops_(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<
+                              !std::is_same<typename std::decay<F>::type, Callable>::value>::type>
+    Callable(F&& f) : ops_(nullptr) {
+        typedef typename std::decay<F>::type Fn;
+        construct<Fn>(std::forward<F>(f), Inline<Fn>());
+    }
+
+    Callable(Callable&& other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(&other.storage_, &storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Callable& operator=(Callable&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(&other.storage_, &storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Callable(const Callable&) = delete;
+    Callable& operator=(const Callable&) = delete;
+
+    ~Callable() { reset(); }
+
+    void operator()() { ops_->call(&storage_); }
+    explicit operator bool() const { return ops_ != nullptr; }
+
+   private:
+    typedef typename std::aligned_storage<kCallableInline, alignof(max_align_t)>::type Storage;
+
+    struct Ops
+    {
+        void (*call)(void* storage);
+        // move constructs into to and destroys from
+        void (*move)(void* from, void* to);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename Fn>
+    struct Inline : std::integral_constant<bool, sizeof(Fn) <= sizeof(Storage) && alignof(Fn) <= alignof(Storage) &&
+                                                     std::is_nothrow_move_constructible<Fn>::value> {};
+
+    template <typename Fn>
+    struct InlineOps
+    {
+        static void call(void* s) { (*static_cast<Fn*>(s))(); }
+        static void move(void* from, void* to) {
+            new (to) Fn(std::move(*static_cast<Fn*>(from)));
+            static_cast<Fn*>(from)->~Fn();
+        }
+        static void destroy(void* s) { static_cast<Fn*>(s)->~Fn(); }
+        static const Ops ops;
+    };
+
+    template <typename Fn>
+    struct HeapOps
+    {
+        static void call(void* s) { (**static_cast<Fn**>(s))(); }
+        static void move(void* from, void* to) { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); }
+        static void destroy(void* s) { delete *static_cast<Fn**>(s); }
+        static const Ops ops;
+    };
+
+    template <typename Fn, typename F>
+    void construct(F&& f, std::true_type) {
+        new (&storage_) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+
+    template <typename Fn, typename F>
+    void construct(F&& f, std::false_type) {
+        new (&storage_) Fn*(new Fn(std::forward<F>(f)));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    Storage storage_;
+    const Ops* ops_;
+};
+
+template <typename Fn>
+const Callable::Ops Callable::InlineOps<Fn>::ops = {&InlineOps<Fn>::call, &InlineOps<Fn>::move,
+                                                    &InlineOps<Fn>::destroy};
+
+template <typename Fn>
+const Callable::Ops Callable::HeapOps<Fn>::ops = {&HeapOps<Fn>::call, &HeapOps<Fn>::move, &HeapOps<Fn>::destroy};
+
+}  // namespace chord
@@ -0,0 +1,287 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+#include <algorithm>
+
+#include "channel.h"
+#include "envelope.h"
+#include "frame_buffer.h"
+#include "socket-util.h"
+
+namespace chord {
+
+std::shared_ptr<Channel> Channel::connect(const struct sockaddr_in& addr) {
+    int32_t sockfd;
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        return nullptr;
+    }
+    if (::connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sockfd);
+        return nullptr;
+    }
+    // requests and replies are small and latency bound
+    int opt = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+    return std::shared_ptr<Channel>(new Channel(sockfd));
+}
+
+Channel::Channel(int32_t sockfd)
+    : sockfd_(sockfd),
+      broken_(false),
+      version_(kLegacyEnvelope),
+      next_id_(1),
+      last_used_(Clock::now().time_since_epoch().count()),
+      busy_until_(0),
+      shed_at_(0) {
+    reader_ = std::thread(&Channel::readLoop, this);
+}
+
+Channel::Channel()
+    : sockfd_(-1),
+      broken_(false),
+      version_(kEnvelopeVersion),
+      next_id_(1),
+      last_used_(Clock::now().time_since_epoch().count()),
+      busy_until_(0),
+      shed_at_(0) {}
+
+Channel::~Channel() {
+    if (sockfd_ < 0) {
+        return;
+    }
+    // wakes the reader up with an error, it fails whatever is still pending
+    shutdown(sockfd_, SHUT_RDWR);
+    reader_.join();
+    close(sockfd_);
+}
+
+bool Channel::idle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.empty();
+}
+
+int32_t Channel::busyFor() const {
+    Clock::duration left = Clock::duration(busy_until_.load()) - Clock::now().time_since_epoch();
+    return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(left).count());
+}
+
+bool Channel::shedding() const {
+    Clock::rep shed_at = shed_at_;
+    return shed_at != 0 && Clock::now() - Clock::time_point(Clock::duration(shed_at)) <
+                               std::chrono::milliseconds(kMaxBusyBackoffMs);
+}
+
+bool Channel::call(protocol::Request& request, protocol::Response* response, int32_t timeout_ms) {
+    std::promise<bool> promise;
+    auto done = promise.get_future();
+
+    PendingCall pending;
+    pending.response = response;
+    pending.done     = [&promise](bool ok) { promise.set_value(ok); };
+    uint64_t id      = start(request, &pending);
+
+    if (id != 0 && done.wait_for(std::chrono::milliseconds(timeout_ms)) != std::future_status::ready) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.erase(id) == 1) {
+            LOG(WARNING) << "Call " << id << " timed out";
+            // not just busy any more
+            shed_at_ = 0;
+            return false;
+        }
+        // the reader took it in the meantime and is about to complete it
+    }
+    if (!done.get()) {
+        return false;
+    }
+    if (!response->success() || (uint32_t)response->body_case() != pending.method) {
+        LOG(WARNING) << "Call to method " << pending.method << " failed";
+        return false;
+    }
+    return true;
+}
+
+uint64_t Channel::callAsync(protocol::Request& request, Callback done) {
+    // owns the response, and deletes itself once completed
+    struct AsyncCall : PendingCall
+    {
+        protocol::Response reply;
+        Callback callback;
+    };
+    AsyncCall* call = new AsyncCall;
+    call->response  = &call->reply;
+    call->callback  = std::move(done);
+    call->done      = [call](bool ok) {
+        ok = ok && call->reply.success() && (uint32_t)call->reply.body_case() == call->method;
+        call->callback(ok, &call->reply);
+        delete call;
+    };
+    return start(request, call);
+}
+
+void Channel::cancel(uint64_t id) {
+    PendingCall* pending = take(id);
+    if (pending != nullptr) {
+        pending->done(false);
+    }
+}
+
+uint64_t Channel::start(protocol::Request& request, PendingCall* pending) {
+    uint64_t id = next_id_++;
+    request.set_id(id);
+
+    // reused by every call of this thread, it keeps its capacity
+    thread_local std::string binary;
+    uint8_t version = version_;
+    if (version >= kEnvelopeVersion) {
+        CHECK_EQ(request.SerializeToString(&binary), true);
+    } else {
+        // until the peer has shown it speaks the typed envelope
+        protocol::Call call;
+        envelope_to_call(request, &call);
+        CHECK_EQ(call.SerializeToString(&binary), true);
+    }
+
+    pending->method = request.body_case();
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (broken_) {
+            lock.unlock();
+            pending->done(false);
+            return 0;
+        }
+        pending_[id] = pending;
+    }
+    last_used_ = Clock::now().time_since_epoch().count();
+
+    ssize_t sent;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        sent = send_frame(sockfd_, binary.data(), binary.size(), version, MSG_NOSIGNAL);
+    }
+    if (sent != (ssize_t)(binary.size() + sizeof(uint64_t))) {
+        LOG(WARNING) << "Failed to send";
+        fail();
+    }
+    return id;
+}
+
+void Channel::readLoop() {
+    FrameBuffer in;
+    bool ok = true;
+    while (ok) {
+        ssize_t got = in.fill(sockfd_);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        const uint8_t* body;
+        size_t size;
+        uint8_t version;
+        int32_t status;
+        while (ok && (status = in.next(&body, &size, &version)) == 1) {
+            ok = version == kEnvelopeVersion ? completeResponse(body, size) : completeReturn(body, size);
+            if (!ok) {
+                LOG(WARNING) << "Malformed reply";
+            }
+        }
+        if (ok && status < 0) {
+            LOG(ERROR) << "Invalid reply header";
+            ok = false;
+        }
+    }
+    fail();
+}
+
+bool Channel::completeResponse(const uint8_t* body, size_t size) {
+    protocol::Response response;
+    if (!response.ParseFromArray(body, size) || !response.has_id()) {
+        return false;
+    }
+    if (response.has_busy_ms()) {
+        busy(response.busy_ms());
+    }
+    // a reply to a call that already timed out is dropped
+    PendingCall* pending = take(response.id());
+    if (pending != nullptr) {
+        pending->response->Swap(&response);
+        pending->done(true);
+    }
+    return true;
+}
+
+bool Channel::completeReturn(const uint8_t* body, size_t size) {
+    protocol::Return ret;
+    if (!ret.ParseFromArray(body, size)) {
+        return false;
+    }
+    // peers that speak a newer envelope say so in every version 0 reply
+    if (ret.version() > version_) {
+        version_ = std::min<uint32_t>(ret.version(), kEnvelopeVersion);
+    }
+    if (ret.has_busy_ms()) {
+        busy(ret.busy_ms());
+    }
+    // a node that predates call ids answers its calls in order
+    PendingCall* pending = ret.has_id() ? take(ret.id()) : takeOldest();
+    if (pending != nullptr) {
+        pending->done(envelope_from_return(ret, pending->method, pending->response));
+    }
+    return true;
+}
+
+void Channel::busy(uint32_t backoff_ms) {
+    auto backoff          = std::chrono::milliseconds(std::min<uint32_t>(backoff_ms, kMaxBusyBackoffMs));
+    Clock::time_point now = Clock::now();
+    busy_until_           = (now + backoff).time_since_epoch().count();
+    shed_at_              = now.time_since_epoch().count();
+}
+
+Channel::PendingCall* Channel::take(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(id);
+    if (it == pending_.end()) {
+        return nullptr;
+    }
+    PendingCall* pending = it->second;
+    pending_.erase(it);
+    return pending;
+}
+
+Channel::PendingCall* Channel::takeOldest() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto oldest = pending_.end();
+    for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+        if (oldest == pending_.end() || it->first < oldest->first) {
+            oldest = it;
+        }
+    }
+    if (oldest == pending_.end()) {
+        return nullptr;
+    }
+    PendingCall* pending = oldest->second;
+    pending_.erase(oldest);
+    return pending;
+}
+
+void Channel::fail() {
+    std::unordered_map<uint64_t, PendingCall*> failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        broken_ = true;
+        failed.swap(pending_);
+    }
+    // outside the lock, a callback may start another call
+    for (auto& p : failed) {
+        p.second->done(false);
+    }
+}
+
+}  // namespace chord
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "proto/chord.pb.h"
+
+namespace chord {
+
+/*! \brief a call without a reply after this long fails, the channel stays usable. */
+const int32_t kCallTimeoutMs = 10000;
+
+/**
+ * \brief  the longest backoff a busy peer may ask for, and how long after
+ *         shedding a call it still counts as alive but overloaded.
+ */
+const int32_t kMaxBusyBackoffMs = 1000;
+
+/**
+ * \brief  a client connection to one peer that multiplexes calls. Every call
+ *         gets a request id, any number of threads can have calls in flight
+ *         at once, and a reader thread completes them in whatever order the
+ *         peer answers.
+ */
+class Channel {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    /*! \brief completes an asynchronous call, response is only valid during the call. */
+    typedef std::function<void(bool ok, protocol::Response* response)> Callback;
+
+    /*! \brief connects to addr, or returns nullptr if the peer cannot be reached. */
+    static std::shared_ptr<Channel> connect(const struct sockaddr_in& addr);
+
+    virtual ~Channel();
+
+    /**
+     * \brief  assigns request its id, sends it and waits for the response
+     *         carrying the same id. The request goes out in the typed envelope
+     *         once the peer has announced it, and in a Call before that.
+     * \return false if the channel broke, no reply came within timeout_ms, or
+     *         the peer did not answer the method with success.
+     */
+    bool call(protocol::Request& request, protocol::Response* response, int32_t timeout_ms = kCallTimeoutMs);
+
+    /**
+     * \brief  like call(), but returns once the request is sent. done runs
+     *         exactly once: on the reader thread with the reply, or with
+     *         false when the channel breaks or the call is cancelled. It must
+     *         not block, the replies of the channel wait for it.
+     * \return the id of the call, to cancel it, or 0 if done already ran.
+     */
+    uint64_t callAsync(protocol::Request& request, Callback done);
+
+    /*! \brief abandons call id, its done runs with false on this thread unless it ran already. */
+    void cancel(uint64_t id);
+
+    /*! \brief true once the peer hung up or the socket failed. */
+    bool broken() const { return broken_; }
+
+    /*! \brief true if no call is waiting for a reply. */
+    bool idle();
+
+    /*! \brief the ms left of the backoff the peer asked for when it last shed a call as busy, or 0. */
+    int32_t busyFor() const;
+
+    /*! \brief true if the peer shed a call as busy within kMaxBusyBackoffMs, it is alive but overloaded. */
+    bool shedding() const;
+
+    Clock::time_point lastUsed() const { return Clock::time_point(Clock::duration(last_used_.load())); }
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+   protected:
+    /*! \brief a channel without a socket, for a transport that delivers calls by overriding start(). */
+    Channel();
+
+    struct PendingCall
+    {
+        protocol::Response* response;
+        uint32_t method;
+        // runs once the call completed, with false if it failed
+        std::function<void(bool)> done;
+    };
+
+    /**
+     * \brief  assigns request its id, registers pending under it and sends
+     *         the request. If the channel is or becomes broken, pending is
+     *         failed before this returns.
+     * \return the id, or 0 if pending was not registered.
+     */
+    virtual uint64_t start(protocol::Request& request, PendingCall* pending);
+
+   private:
+    explicit Channel(int32_t sockfd);
+
+    /*! \brief reads replies until the socket fails and routes them by id. */
+    void readLoop();
+
+    /**
+     * \brief  parse a reply in the typed envelope or in a Return, and hand it
+     *         to the call waiting for its id, if any.
+     * \return false if the reply is malformed.
+     */
+    bool completeResponse(const uint8_t* body, size_t size);
+    bool completeReturn(const uint8_t* body, size_t size);
+
+    /*! \brief the peer shed a call, it asked for backoff_ms before the next one. */
+    void busy(uint32_t backoff_ms);
+
+    /*! \brief removes the call waiting for id, or returns nullptr if there is none. */
+    PendingCall* take(uint64_t id);
+
+    /*! \brief removes the call sent first of those waiting, or returns nullptr if there is none. */
+    PendingCall* takeOldest();
+
+    /*! \brief marks the channel broken and fails every call in flight. */
+    void fail();
+
+    int32_t sockfd_;
+    std::atomic<bool> broken_;
+    // the newest envelope the peer is known to speak
+    std::atomic<uint8_t> version_;
+    std::atomic<uint64_t> next_id_;
+    std::atomic<Clock::rep> last_used_;
+    // until when the peer asked to be left alone, and when it last shed a call
+    std::atomic<Clock::rep> busy_until_;
+    std::atomic<Clock::rep> shed_at_;
+
+    // serializes frames so that concurrent callers never interleave bytes
+    std::mutex write_mutex_;
+
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, PendingCall*> pending_;
+
+    std::thread reader_;
+};
+
+}  // namespace chord
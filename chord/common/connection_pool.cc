@@ -0,0 +1,123 @@
+#include "connection_pool.h"
+
+namespace chord {
+
+ConnectionPool& ConnectionPool::Instance() {
+    static ConnectionPool pool;
+    return pool;
+}
+
+std::shared_ptr<Channel> ConnectionPool::acquire(const struct sockaddr_in& addr, bool* reused) {
+    uint64_t key = peer_key(addr);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = channels_.find(key);
+        if (it != channels_.end() && !it->second->broken()) {
+            *reused = true;
+            return it->second;
+        }
+    }
+
+    // connect outside the lock, calls to other peers must not wait on it
+    *reused                          = false;
+    std::shared_ptr<Channel> channel = transport_->connect(addr);
+    if (channel == nullptr) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = channels_[key];
+    if (slot != nullptr && !slot->broken()) {
+        // another thread connected first, share its channel
+        *reused = true;
+        return slot;
+    }
+    slot = channel;
+    return channel;
+}
+
+#ifdef CHORD_WITH_COROUTINES
+void ConnectionPool::connect(ConnectAwaiter* waiter, std::coroutine_handle<> h) {
+    struct sockaddr_in addr = waiter->addr;
+    uint64_t key            = peer_key(addr);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& waiting = connecting_[key];
+        waiting.emplace_back(waiter, h);
+        if (waiting.size() > 1) {
+            return;
+        }
+    }
+    connectors_.AddTask([this, addr, key] {
+        bool reused                      = false;
+        std::shared_ptr<Channel> channel = acquire(addr, &reused);
+
+        std::vector<std::pair<ConnectAwaiter*, std::coroutine_handle<>>> waiting;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiting.swap(connecting_[key]);
+            connecting_.erase(key);
+        }
+        for (auto& w : waiting) {
+            w.first->channel = channel;
+            *w.first->reused = reused;
+            Executor::Instance().post(w.second);
+        }
+    });
+}
+#endif
+
+std::shared_ptr<Channel> ConnectionPool::find(const struct sockaddr_in& addr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = channels_.find(peer_key(addr));
+    if (it == channels_.end() || it->second->broken()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+void ConnectionPool::invalidate(const struct sockaddr_in& addr) {
+    std::shared_ptr<Channel> channel;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = channels_.find(peer_key(addr));
+        if (it == channels_.end()) {
+            return;
+        }
+        channel = it->second;
+        channels_.erase(it);
+    }
+    // callers still holding it finish first, the socket closes with the last one
+}
+
+int32_t ConnectionPool::busyFor(const struct sockaddr_in& addr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = channels_.find(peer_key(addr));
+    return it == channels_.end() ? 0 : it->second->busyFor();
+}
+
+bool ConnectionPool::shedding(const struct sockaddr_in& addr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = channels_.find(peer_key(addr));
+    return it != channels_.end() && !it->second->broken() && it->second->shedding();
+}
+
+void ConnectionPool::evictIdle() {
+    std::vector<std::shared_ptr<Channel>> evicted;
+    auto deadline = Channel::Clock::now() - std::chrono::milliseconds(kIdleTimeoutMs);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = channels_.begin(); it != channels_.end();) {
+            auto& channel = it->second;
+            if (channel->broken() || (channel->idle() && channel->lastUsed() < deadline)) {
+                evicted.push_back(channel);
+                it = channels_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // closing joins the reader threads, do it without holding the lock
+}
+
+}  // namespace chord
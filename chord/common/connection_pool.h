@@ -0,0 +1,176 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "channel.h"
+#include "coro.h"
+#include "thread_pool.h"
+#include "transport.h"
+
+namespace chord {
+
+/*! \brief channels without calls in flight for this long are closed by evictIdle(). */
+const int32_t kIdleTimeoutMs = 30000;
+
+#ifdef CHORD_WITH_COROUTINES
+/*! \brief threads that connect new channels for coroutines, so that the executor never blocks on a handshake. */
+const int kConnectThreads = 4;
+#endif
+
+/*! \brief identifies a peer by its IPv4 address and port (network byte order). */
+inline uint64_t peer_key(const struct sockaddr_in& addr) {
+    return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+/**
+ * \brief  keeps one multiplexed channel open per peer, so that a request to
+ *         a known peer does not pay for a TCP handshake, does not leave a
+ *         socket behind in TIME_WAIT, and concurrent requests to the same
+ *         peer share the connection instead of queueing for it.
+ */
+class ConnectionPool {
+   public:
+    static ConnectionPool& Instance();
+
+    /**
+     * \brief  connects new channels over transport instead of TCP. Set it
+     *         before the first call, channels already open stay as they are.
+     */
+    void setTransport(Transport* transport) { transport_ = transport; }
+
+    /**
+     * \brief  returns the live channel to addr, connecting one if needed.
+     *         reused is set when the channel was already open.
+     * \return the channel, or nullptr if the peer cannot be reached.
+     */
+    std::shared_ptr<Channel> acquire(const struct sockaddr_in& addr, bool* reused);
+
+    /*! \brief the live channel to addr if one is open, it never connects and so never blocks. */
+    std::shared_ptr<Channel> find(const struct sockaddr_in& addr);
+
+    /*! \brief closes the channel to addr, e.g. after the peer failed. */
+    void invalidate(const struct sockaddr_in& addr);
+
+    /*! \brief the ms left of the backoff addr asked for by shedding a call as busy, or 0. */
+    int32_t busyFor(const struct sockaddr_in& addr);
+
+    /*! \brief true if addr is connected and recently shed a call as busy. */
+    bool shedding(const struct sockaddr_in& addr);
+
+    /**
+     * \brief  closes channels that are broken, or that had no call in flight
+     *         for longer than kIdleTimeoutMs.
+     * \note   called periodically.
+     */
+    void evictIdle();
+
+    /**
+     * \brief  runs rpc(channel) over the channel to addr. A failure on a
+     *         reused channel that turned out to be broken is retried once on
+     *         a fresh one, because the peer may have dropped it while idle.
+     */
+    template <typename F>
+    bool call(const struct sockaddr_in& addr, F&& rpc);
+
+#ifdef CHORD_WITH_COROUTINES
+    /*! \brief call() for coroutines, rpc(channel) returns a Task<bool>. */
+    template <typename F>
+    Task<bool> callCo(struct sockaddr_in addr, F rpc);
+#endif
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+   private:
+#ifdef CHORD_WITH_COROUTINES
+    ConnectionPool() : transport_(&tcp_), connectors_(kConnectThreads) {}
+
+    /**
+     * \brief  co_await acquireCo() is acquire() for coroutines. An open
+     *         channel is returned right away, a connect runs on connectors_
+     *         and the coroutine resumes on the executor once it is done.
+     */
+    struct ConnectAwaiter
+    {
+        ConnectionPool* pool;
+        struct sockaddr_in addr;
+        bool* reused;
+        std::shared_ptr<Channel> channel;
+
+        bool await_ready() {
+            channel = pool->find(addr);
+            *reused = channel != nullptr;
+            return channel != nullptr;
+        }
+        void await_suspend(std::coroutine_handle<> h) { pool->connect(this, h); }
+        std::shared_ptr<Channel> await_resume() { return channel; }
+    };
+
+    ConnectAwaiter acquireCo(const struct sockaddr_in& addr, bool* reused) {
+        return ConnectAwaiter{this, addr, reused, nullptr};
+    }
+
+    /*! \brief acquire() for waiter off the executor, coroutines waiting on the same peer share one attempt. */
+    void connect(ConnectAwaiter* waiter, std::coroutine_handle<> h);
+#else
+    ConnectionPool() : transport_(&tcp_) {}
+#endif
+
+    TcpTransport tcp_;
+    Transport* transport_;
+
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, std::shared_ptr<Channel>> channels_;
+
+#ifdef CHORD_WITH_COROUTINES
+    threadpool connectors_;
+    // coroutines waiting for the connect in progress to a peer, by peer_key()
+    std::unordered_map<uint64_t, std::vector<std::pair<ConnectAwaiter*, std::coroutine_handle<>>>> connecting_;
+#endif
+};
+
+template <typename F>
+bool ConnectionPool::call(const struct sockaddr_in& addr, F&& rpc) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused                      = false;
+        std::shared_ptr<Channel> channel = acquire(addr, &reused);
+        if (channel == nullptr) {
+            return false;
+        }
+        if (rpc(channel.get())) {
+            return true;
+        }
+        if (!channel->broken() || !reused) {
+            return false;
+        }
+        invalidate(addr);
+    }
+    return false;
+}
+
+#ifdef CHORD_WITH_COROUTINES
+template <typename F>
+Task<bool> ConnectionPool::callCo(struct sockaddr_in addr, F rpc) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused                      = false;
+        std::shared_ptr<Channel> channel = co_await acquireCo(addr, &reused);
+        if (channel == nullptr) {
+            co_return false;
+        }
+        if (co_await rpc(channel)) {
+            co_return true;
+        }
+        if (!channel->broken() || !reused) {
+            co_return false;
+        }
+        invalidate(addr);
+    }
+    co_return false;
+}
+#endif
+
+}  // namespace chord
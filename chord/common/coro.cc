@@ -0,0 +1,66 @@
+#include "coro.h"
+
+#ifdef CHORD_WITH_COROUTINES
+
+namespace chord {
+
+Executor& Executor::Instance() {
+    // never destroyed, spawned coroutines may still be running at exit
+    static Executor* executor = new Executor(kExecutorThreads);
+    return *executor;
+}
+
+Executor::Executor(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&Executor::run, this);
+        threads_.back().detach();
+    }
+}
+
+void Executor::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void Executor::postAt(Clock::time_point when, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timers_.push(Timer(when, std::move(task)));
+    }
+    // the earliest timer may have changed, the thread waiting for it has to know
+    cv_.notify_all();
+}
+
+void Executor::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (1) {
+        while (!timers_.empty() && timers_.top().first <= Clock::now()) {
+            ready_.push_back(std::move(const_cast<Timer&>(timers_.top()).second));
+            timers_.pop();
+        }
+        if (ready_.empty()) {
+            if (timers_.empty()) {
+                cv_.wait(lock);
+            } else {
+                // a copy, the heap may grow while the lock is released
+                auto when = timers_.top().first;
+                cv_.wait_until(lock, when);
+            }
+            continue;
+        }
+
+        std::function<void()> task = std::move(ready_.front());
+        ready_.pop_front();
+        lock.unlock();
+        task();
+        task = nullptr;
+        lock.lock();
+    }
+}
+
+}  // namespace chord
+
+#endif  // CHORD_WITH_COROUTINES
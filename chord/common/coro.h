@@ -0,0 +1,251 @@
+#pragma once
+
+#ifdef CHORD_WITH_COROUTINES
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace chord {
+
+/*! \brief threads of the executor, a coroutine only holds one while it runs. */
+const size_t kExecutorThreads = 2;
+
+namespace detail {
+/*! \brief resumes the awaiting coroutine once a task is done, or nothing if it was spawned. */
+struct FinalAwaiter
+{
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+        std::coroutine_handle<> next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase
+{
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    // failures are return values in this code base, an exception is a bug
+    void unhandled_exception() { std::terminate(); }
+
+    std::coroutine_handle<> continuation;
+};
+}  // namespace detail
+
+/**
+ * \brief  a coroutine returning T. It starts when awaited, and resumes its
+ *         awaiter right away when it is done, on the same thread.
+ */
+template <typename T>
+class Task {
+   public:
+    struct promise_type : detail::PromiseBase
+    {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_value(T v) { value = std::move(v); }
+
+        T value;
+    };
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    T await_resume() { return std::move(handle_.promise().value); }
+
+   private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <>
+class Task<void> {
+   public:
+    struct promise_type : detail::PromiseBase
+    {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() {}
+    };
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    void await_resume() {}
+
+   private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * \brief  a few threads resuming coroutines: ones that are ready, and ones
+ *         whose sleep is over. A coroutine waiting for a reply or a timer
+ *         costs its frame and no thread.
+ */
+class Executor {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    static Executor& Instance();
+
+    void post(std::function<void()> task);
+    void post(std::coroutine_handle<> h) { post([h] { h.resume(); }); }
+
+    /*! \brief runs task at when, or soon after. */
+    void postAt(Clock::time_point when, std::function<void()> task);
+
+    /*! \brief co_await schedule() moves the awaiting coroutine onto the executor. */
+    auto schedule() {
+        struct Awaiter
+        {
+            Executor* executor;
+
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> h) { executor->post(h); }
+            void await_resume() {}
+        };
+        return Awaiter{this};
+    }
+
+    /*! \brief co_await sleep(ms) resumes the awaiting coroutine on the executor ms later. */
+    auto sleep(int32_t ms) {
+        struct Awaiter
+        {
+            Executor* executor;
+            Clock::time_point when;
+
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> h) { executor->postAt(when, [h] { h.resume(); }); }
+            void await_resume() {}
+        };
+        return Awaiter{this, Clock::now() + std::chrono::milliseconds(ms)};
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+   private:
+    explicit Executor(size_t threads);
+
+    void run();
+
+    typedef std::pair<Clock::time_point, std::function<void()>> Timer;
+    struct Later
+    {
+        bool operator()(const Timer& a, const Timer& b) const { return a.first > b.first; }
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> ready_;
+    std::priority_queue<Timer, std::vector<Timer>, Later> timers_;
+    std::vector<std::thread> threads_;
+};
+
+namespace detail {
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+}  // namespace detail
+
+/*! \brief runs task on the executor without waiting for it, its frame goes when it is done. */
+inline detail::Detached spawn(Task<void> task) {
+    co_await Executor::Instance().schedule();
+    co_await task;
+}
+
+/*! \brief spawn(), then calls done once task is done, as a timer of TimerWheel::createAsync() needs. */
+inline detail::Detached spawn(Task<void> task, std::function<void()> done) {
+    co_await Executor::Instance().schedule();
+    co_await task;
+    done();
+}
+
+namespace detail {
+struct Join
+{
+    std::atomic<size_t> left;
+    std::coroutine_handle<> awaiter;
+};
+
+inline Detached join_one(Task<void> task, std::shared_ptr<Join> join) {
+    co_await Executor::Instance().schedule();
+    co_await task;
+    if (--join->left == 0) {
+        Executor::Instance().post(join->awaiter);
+    }
+}
+}  // namespace detail
+
+/*! \brief co_await all(tasks) runs the tasks together on the executor and resumes once every one is done. */
+inline auto all(std::vector<Task<void>> tasks) {
+    struct Awaiter
+    {
+        std::vector<Task<void>> tasks;
+
+        bool await_ready() { return tasks.empty(); }
+        void await_suspend(std::coroutine_handle<> h) {
+            // the awaiter goes once the last task is done, which may be before the loop is
+            std::vector<Task<void>> run = std::move(tasks);
+            auto join                   = std::make_shared<detail::Join>();
+            join->left                  = run.size();
+            join->awaiter               = h;
+            for (auto& task : run) {
+                detail::join_one(std::move(task), join);
+            }
+        }
+        void await_resume() {}
+    };
+    return Awaiter{std::move(tasks)};
+}
+
+}  // namespace chord
+
+#endif  // CHORD_WITH_COROUTINES
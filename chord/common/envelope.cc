@@ -0,0 +1,85 @@
+#include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+
+#include "envelope.h"
+
+namespace chord {
+
+namespace {
+// the oneof member of message for method, or nullptr
+const google::protobuf::FieldDescriptor* body_field(const google::protobuf::Descriptor* message, uint32_t method) {
+    const google::protobuf::FieldDescriptor* field = message->FindFieldByNumber(method);
+    if (field == nullptr || field->containing_oneof() == nullptr) {
+        return nullptr;
+    }
+    return field;
+}
+}  // namespace
+
+void envelope_to_call(const protocol::Request& request, protocol::Call* call) {
+    const google::protobuf::FieldDescriptor* field = body_field(request.GetDescriptor(), request.body_case());
+    CHECK(field != nullptr) << "Request without a body";
+
+    call->set_id(request.id());
+    call->set_name(field->name());
+    call->set_method(request.body_case());
+    call->set_version(kEnvelopeVersion);
+    const google::protobuf::Message& args = request.GetReflection()->GetMessage(request, field);
+    CHECK_EQ(args.SerializeToString(call->mutable_args()), true);
+}
+
+bool envelope_from_call(const protocol::Call& call, protocol::Request* request) {
+    request->set_id(call.id());
+    const google::protobuf::FieldDescriptor* field = nullptr;
+    if (call.has_method()) {
+        field = body_field(request->GetDescriptor(), call.method());
+    } else {
+        // from a node that predates the method ids
+        field = request->GetDescriptor()->FindFieldByName(call.name());
+        if (field != nullptr && field->containing_oneof() == nullptr) {
+            field = nullptr;
+        }
+    }
+    if (field == nullptr) {
+        return false;
+    }
+    if (!request->GetReflection()->MutableMessage(request, field)->ParseFromString(call.args())) {
+        request->clear_body();
+        return false;
+    }
+    return true;
+}
+
+void envelope_to_return(const protocol::Response& response, protocol::Return* ret) {
+    ret->set_id(response.id());
+    ret->set_success(response.success());
+    ret->set_version(kEnvelopeVersion);
+    if (response.has_busy_ms()) {
+        ret->set_busy_ms(response.busy_ms());
+    }
+
+    const google::protobuf::FieldDescriptor* field = body_field(response.GetDescriptor(), response.body_case());
+    if (field != nullptr) {
+        const google::protobuf::Message& value = response.GetReflection()->GetMessage(response, field);
+        CHECK_EQ(value.SerializeToString(ret->mutable_value()), true);
+    }
+}
+
+bool envelope_from_return(const protocol::Return& ret, uint32_t method, protocol::Response* response) {
+    response->set_id(ret.id());
+    response->set_success(ret.success());
+    if (ret.has_busy_ms()) {
+        response->set_busy_ms(ret.busy_ms());
+    }
+    if (!ret.success()) {
+        return true;
+    }
+
+    const google::protobuf::FieldDescriptor* field = body_field(response->GetDescriptor(), method);
+    if (field == nullptr) {
+        return false;
+    }
+    return response->GetReflection()->MutableMessage(response, field)->ParseFromString(ret.value());
+}
+
+}  // namespace chord
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "proto/chord.pb.h"
+
+namespace chord {
+
+/**
+ * \brief  envelope versions, carried in the top byte of every frame header.
+ *         Version 0 is Call/Return with nested serialized messages, version
+ *         1 is Request/Response with the typed messages in a oneof.
+ */
+const uint8_t kLegacyEnvelope = 0;
+const uint8_t kEnvelopeVersion = 1;
+
+/*! \brief wraps request into a version 0 Call, named as well for nodes that predate method ids. */
+void envelope_to_call(const protocol::Request& request, protocol::Call* call);
+
+/**
+ * \brief  unwraps a version 0 Call into request, by its name if it has no method.
+ * \return false if the method is unknown or its args do not parse, request
+ *         then only carries the call id.
+ */
+bool envelope_from_call(const protocol::Call& call, protocol::Request* request);
+
+/*! \brief wraps response into a version 0 Return. */
+void envelope_to_return(const protocol::Response& response, protocol::Return* ret);
+
+/**
+ * \brief  unwraps a version 0 Return to a call of method into response.
+ * \return false if the value does not parse.
+ */
+bool envelope_from_return(const protocol::Return& ret, uint32_t method, protocol::Response* response);
+
+}  // namespace chord
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace chord {
+
+/**
+ * \brief  a queue of items in two classes. Urgent items always leave first,
+ *         in the order they came. The others are queued per flow and leave
+ *         in weighted fair order, by self-clocked fair queuing: an item gets
+ *         the finish tag max(virtual time, tag of the last item of its flow)
+ *         + 1 / weight, the smallest tag leaves first and becomes the virtual
+ *         time. A flow with a deep backlog thus gets its share of the turns
+ *         while other flows have items, and all of them when they have none.
+ * \note   thread-safe.
+ */
+template <typename T>
+class FairQueue {
+   public:
+    FairQueue() : now_(0), size_(0) {}
+
+    void pushUrgent(T item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        urgent_.push_back(std::move(item));
+        ++size_;
+    }
+
+    void push(uint64_t flow, T item, double weight = 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Flow& f    = flows_[flow];
+        double tag = std::max(now_, f.last) + 1 / weight;
+        f.last     = tag;
+        if (f.items.empty()) {
+            heads_.push(Head(tag, flow));
+        }
+        f.items.push_back(std::make_pair(tag, std::move(item)));
+        ++size_;
+    }
+
+    /*! \brief the next item, or false if there is none. */
+    bool pop(T* item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!urgent_.empty()) {
+            *item = std::move(urgent_.front());
+            urgent_.pop_front();
+            --size_;
+            return true;
+        }
+        if (heads_.empty()) {
+            return false;
+        }
+
+        uint64_t flow = heads_.top().second;
+        heads_.pop();
+        auto it = flows_.find(flow);
+        Flow& f = it->second;
+        now_    = f.items.front().first;
+        *item   = std::move(f.items.front().second);
+        f.items.pop_front();
+        --size_;
+
+        if (!f.items.empty()) {
+            heads_.push(Head(f.items.front().first, flow));
+        } else if (f.last <= now_) {
+            // an idle flow starts over from the virtual time, it needs no state
+            flows_.erase(it);
+        }
+        return true;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+   private:
+    struct Flow
+    {
+        Flow() : last(0) {}
+
+        std::deque<std::pair<double, T>> items;
+        double last;
+    };
+
+    // the finish tag of the first item of a flow
+    typedef std::pair<double, uint64_t> Head;
+
+    std::mutex mutex_;
+    std::deque<T> urgent_;
+    std::unordered_map<uint64_t, Flow> flows_;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads_;
+    double now_;
+    size_t size_;
+};
+
+}  // namespace chord
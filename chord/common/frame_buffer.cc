@@ -0,0 +1,68 @@
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "frame_buffer.h"
+#include "net-buffer.h"
+
+namespace chord {
+
+namespace {
+const size_t kRecvBufferSize = 64 * 1024;
+}  // namespace
+
+ssize_t FrameBuffer::fill(int32_t sockfd) {
+    if (begin_ == end_) {
+        begin_ = end_ = 0;
+    }
+
+    // move a partial frame to the front when it would not fit behind begin_,
+    // or when too little room is left for a useful read
+    size_t need = std::max(want_, kRecvBufferSize);
+    if (begin_ > 0 && (buf_.size() - begin_ < need || buf_.size() - end_ < kRecvBufferSize / 4)) {
+        memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    if (buf_.size() < need) {
+        buf_.resize(need);
+    }
+
+    ssize_t got = recv(sockfd, buf_.data() + end_, buf_.size() - end_, 0);
+    if (got > 0) {
+        end_ += got;
+    }
+    return got;
+}
+
+int32_t FrameBuffer::next(const uint8_t** body, size_t* size, uint8_t* version) {
+    size_t got = end_ - begin_;
+    if (got < sizeof(uint64_t)) {
+        return 0;
+    }
+
+    if (want_ == 0) {
+        uint64_t header;
+        memcpy(&header, buf_.data() + begin_, sizeof(uint64_t));
+        header   = ntohll(header);
+        version_ = header >> kFrameVersionShift;
+        header &= (1ULL << kFrameVersionShift) - 1;
+        if (header < sizeof(uint64_t) || header > kMaxFrameSize) {
+            return -1;
+        }
+        want_ = header;
+    }
+    if (got < want_) {
+        return 0;
+    }
+
+    *body = buf_.data() + begin_ + sizeof(uint64_t);
+    *size    = want_ - sizeof(uint64_t);
+    *version = version_;
+    begin_ += want_;
+    want_ = 0;
+    return 1;
+}
+
+}  // namespace chord
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace chord {
+
+/*! \brief upper bound of a single frame, anything larger is a corrupt header. */
+const uint64_t kMaxFrameSize = 64 << 20;
+
+/*! \brief the top byte of a frame header is the envelope version, the rest the frame size. */
+const int32_t kFrameVersionShift = 56;
+
+/*! \brief the frame header of a body of len bytes, in host byte order. */
+inline uint64_t frame_header(size_t len, uint8_t version) {
+    return (static_cast<uint64_t>(version) << kFrameVersionShift) | (len + sizeof(uint64_t));
+}
+
+/**
+ * \brief  the receive buffer of one connection. Bytes are read straight into
+ *         it and complete frames of [uint64 header][body] are handed out as
+ *         pointers into it, so they can be parsed in place. The memory is
+ *         kept for the lifetime of the connection.
+ */
+class FrameBuffer {
+   public:
+    FrameBuffer() : begin_(0), end_(0), want_(0), version_(0) {}
+
+    /**
+     * \brief  reads whatever the socket has into the free space, making room
+     *         for the frame being received first.
+     * \return the result of recv(), frames handed out before are invalidated.
+     */
+    ssize_t fill(int32_t sockfd);
+
+    /**
+     * \brief  takes the next complete frame off the buffer.
+     * \return 1 with body, size and the envelope version set, 0 if more bytes
+     *         are needed, -1 if the frame header is corrupt.
+     */
+    int32_t next(const uint8_t** body, size_t* size, uint8_t* version);
+
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+   private:
+    std::vector<uint8_t> buf_;
+    size_t begin_;
+    size_t end_;
+    // size and envelope version of the frame at begin_, once its header is in
+    size_t want_;
+    uint8_t version_;
+};
+
+}  // namespace chord
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+
+namespace chord {
+
+/**
+ * \brief  sleeps while word holds expected, until futex_wake on word. It may
+ *         also return spuriously, callers check their condition again.
+ */
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected) {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+/*! \brief wakes up to count threads sleeping on word. */
+inline void futex_wake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+}  // namespace chord
@@ -0,0 +1,45 @@
+#include <glog/logging.h>
+
+#include "node_ref.h"
+
+namespace chord {
+
+bool NodeRef::fromProto(const protocol::Node& node, NodeRef* ref) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    if (node.id().size() != SHA_DIGEST_LENGTH || node.port() == 0 || node.port() > UINT16_MAX ||
+        inet_pton(AF_INET, node.address().c_str(), &addr.sin_addr.s_addr) != 1) {
+        return false;
+    }
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(node.port());
+    *ref            = NodeRef(NodeId::from(node.id().data()), addr);
+    if (node.has_coord()) {
+        ref->coord = Coordinate::fromProto(node.coord());
+    }
+    return true;
+}
+
+NodeRef NodeRef::fromProto(const protocol::Node& node) {
+    NodeRef ref;
+    CHECK(fromProto(node, &ref)) << "Invalid node " << node.address() << ":" << node.port();
+    return ref;
+}
+
+void NodeRef::toProto(protocol::Node* node) const {
+    node->set_id(id.data(), SHA_DIGEST_LENGTH);
+    node->set_address(addr());
+    node->set_port(port);
+    if (coord.known()) {
+        coord.toProto(node->mutable_coord());
+    }
+}
+
+std::string NodeRef::addr() const {
+    char buf[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = ip;
+    return inet_ntop(AF_INET, &in, buf, sizeof(buf));
+}
+
+}  // namespace chord
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <openssl/sha.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+#include "proto/chord.pb.h"
+#include "vivaldi.h"
+
+namespace chord {
+
+/*! \brief a 160-bit identifier on the ring, big-endian, copied by value. */
+struct NodeId
+{
+    uint8_t bytes[SHA_DIGEST_LENGTH];
+
+    const uint8_t* data() const { return bytes; }
+    uint8_t* data() { return bytes; }
+
+    /*! \brief the id in the first SHA_DIGEST_LENGTH bytes of p. */
+    static NodeId from(const void* p) {
+        NodeId id;
+        memcpy(id.bytes, p, SHA_DIGEST_LENGTH);
+        return id;
+    }
+
+    std::string str() const { return std::string(bytes, bytes + SHA_DIGEST_LENGTH); }
+
+    bool operator==(const NodeId& other) const { return memcmp(bytes, other.bytes, SHA_DIGEST_LENGTH) == 0; }
+    bool operator!=(const NodeId& other) const { return !(*this == other); }
+    bool operator<(const NodeId& other) const { return memcmp(bytes, other.bytes, SHA_DIGEST_LENGTH) < 0; }
+};
+
+/**
+ * \brief  a peer by value: its id, binary IPv4 address and port, the
+ *         sockaddr_in to reach it, which is built once rather than on every
+ *         call, and its network coordinate as last heard. A default
+ *         constructed NodeRef names no peer.
+ */
+struct NodeRef
+{
+    NodeId id;
+    uint32_t ip;  // network byte order
+    uint16_t port;
+    struct sockaddr_in address;
+    Coordinate coord;
+
+    NodeRef() : ip(0), port(0) {
+        memset(&id, 0, sizeof(id));
+        memset(&address, 0, sizeof(address));
+    }
+
+    NodeRef(const NodeId& id, const struct sockaddr_in& addr)
+        : id(id), ip(addr.sin_addr.s_addr), port(ntohs(addr.sin_port)), address(addr) {}
+
+    /**
+     * \brief  reads a peer off the wire, where its address is a string.
+     * \return false if the message does not hold a valid peer.
+     */
+    static bool fromProto(const protocol::Node& node, NodeRef* ref);
+
+    /*! \brief like fromProto(), but a malformed peer is fatal. */
+    static NodeRef fromProto(const protocol::Node& node);
+
+    void toProto(protocol::Node* node) const;
+
+    bool valid() const { return port != 0; }
+
+    std::string addr() const;
+};
+
+static_assert(std::is_trivially_copyable<NodeId>::value, "NodeId is copied as raw bytes");
+static_assert(sizeof(NodeId) == SHA_DIGEST_LENGTH, "NodeId must not be padded");
+
+}  // namespace chord
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace chord {
+
+/*! \brief reader counters are spread over this many cache lines. */
+const size_t kRcuShards = 16;
+
+/*! \brief a writer waiting for readers yields this often before it sleeps. */
+const int kRcuSpins = 64;
+
+/**
+ * \brief  read-copy-update of a value of type T. Readers pin the current
+ *         version with a single atomic increment and never wait; a writer
+ *         copies the current version, modifies the copy and swaps it in,
+ *         then frees the old version once every reader that may still see
+ *         it is gone.
+ *
+ *         Readers are counted per epoch parity. To retire a version the
+ *         writer flips the epoch twice and after each flip waits for the
+ *         readers of the previous parity to leave, so that readers arriving
+ *         meanwhile, which only see the new version, cannot keep it waiting.
+ */
+template <typename T>
+class Rcu {
+   public:
+    /*! \brief a pinned, immutable version of the value. */
+    class Reader {
+       public:
+        Reader(Reader&& other) : readers_(other.readers_), value_(other.value_) { other.readers_ = nullptr; }
+        ~Reader() {
+            if (readers_ != nullptr) {
+                readers_->fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        const T& operator*() const { return *value_; }
+        const T* operator->() const { return value_; }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+       private:
+        friend class Rcu;
+        Reader(std::atomic<int64_t>* readers, const T* value) : readers_(readers), value_(value) {}
+
+        std::atomic<int64_t>* readers_;
+        const T* value_;
+    };
+
+    Rcu() : value_(new T()), epoch_(0) {}
+    ~Rcu() { delete value_.load(); }
+
+    /**
+     * \brief  pins the current version until the reader is destroyed.
+     * \note   keep readers short, and never update() while holding one:
+     *         the writer waits for it.
+     */
+    Reader read() const {
+        std::atomic<int64_t>* readers = shards_[shard()].readers;
+        readers += epoch_.load() & 1;
+        readers->fetch_add(1);
+        return Reader(readers, value_.load());
+    }
+
+    /**
+     * \brief  runs f on a copy of the current version, and publishes the
+     *         copy if f returns true. Writers are serialized.
+     * \return what f returned.
+     */
+    template <typename F>
+    bool update(F&& f) {
+        std::lock_guard<std::mutex> lock(writer_);
+        T* next = new T(*value_.load());
+        if (!f(*next)) {
+            delete next;
+            return false;
+        }
+        T* prev = value_.exchange(next);
+        synchronize();
+        delete prev;
+        return true;
+    }
+
+    Rcu(const Rcu&) = delete;
+    Rcu& operator=(const Rcu&) = delete;
+
+   private:
+    struct Shard
+    {
+        std::atomic<int64_t> readers[2];
+        char pad[64 - 2 * sizeof(std::atomic<int64_t>)];
+
+        Shard() {
+            readers[0] = 0;
+            readers[1] = 0;
+        }
+    };
+
+    /*! \brief the shard of the calling thread. */
+    static size_t shard() {
+        static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % kRcuShards;
+        return index;
+    }
+
+    /*! \brief waits until no reader can still see a version swapped out before the call. */
+    void synchronize() {
+        for (int flip = 0; flip < 2; ++flip) {
+            uint64_t parity = epoch_.fetch_add(1) & 1;
+            for (size_t i = 0; i < kRcuShards; ++i) {
+                // a reader preempted while pinned needs the CPU to leave
+                for (int spins = 0; shards_[i].readers[parity].load(std::memory_order_acquire) != 0; ++spins) {
+                    if (spins < kRcuSpins) {
+                        std::this_thread::yield();
+                    } else {
+                        std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    }
+                }
+            }
+        }
+    }
+
+    std::atomic<T*> value_;
+    std::atomic<uint64_t> epoch_;
+    mutable Shard shards_[kRcuShards];
+    std::mutex writer_;
+};
+
+}  // namespace chord
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "net-buffer.h"
+#include "reactor.h"
+
+namespace chord {
+
+namespace {
+const int32_t kMaxEvents   = 256;
+const int32_t kSweepMs     = 1000;
+const uint32_t kSessionEvs = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+}  // namespace
+
+Session::Session(int32_t sockfd)
+    : sockfd_(sockfd), last_active_(std::chrono::steady_clock::now()), out_pos_(0), broken_(false) {}
+
+Session::~Session() { close(sockfd_); }
+
+bool Session::send(const std::string& binary, uint8_t version) {
+    uint64_t packed_size = htonll(frame_header(binary.size(), version));
+    size_t total         = binary.size() + sizeof(uint64_t);
+
+    std::lock_guard<std::mutex> lock(out_mutex_);
+    if (broken_) {
+        return false;
+    }
+
+    size_t sent = 0;
+    if (out_pos_ == out_.size()) {
+        struct iovec iov[2];
+        iov[0].iov_base = &packed_size;
+        iov[0].iov_len  = sizeof(uint64_t);
+        iov[1].iov_base = const_cast<char*>(binary.data());
+        iov[1].iov_len  = binary.size();
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = 2;
+
+        ssize_t n;
+        while ((n = sendmsg(sockfd_, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0 && errno == EINTR) {
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            broken_ = true;
+            return false;
+        }
+        sent = n > 0 ? n : 0;
+        if (sent == total) {
+            return true;
+        }
+    }
+
+    // queue the rest behind anything pending, the reactor flushes it in order
+    if (sent < sizeof(uint64_t)) {
+        out_.append((const char*)&packed_size + sent, sizeof(uint64_t) - sent);
+        sent = sizeof(uint64_t);
+    }
+    out_.append(binary, sent - sizeof(uint64_t), std::string::npos);
+    return true;
+}
+
+bool Session::flushLocked() {
+    while (out_pos_ < out_.size()) {
+        ssize_t sent = ::send(sockfd_, out_.data() + out_pos_, out_.size() - out_pos_, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            out_pos_ += sent;
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the reactor picks this up again on the next EPOLLOUT edge
+            return true;
+        } else {
+            broken_ = true;
+            return false;
+        }
+    }
+    out_.clear();
+    out_pos_ = 0;
+    return true;
+}
+
+Reactor::Reactor(int32_t listen_sockfd, FrameHandler on_frame)
+    : listen_sockfd_(listen_sockfd), on_frame_(on_frame), last_sweep_(std::chrono::steady_clock::now()) {
+    CHECK_GE(epfd_ = epoll_create1(EPOLL_CLOEXEC), 0) << "Failed to create epoll instance";
+
+    struct epoll_event ev;
+    ev.events  = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_sockfd_;
+    CHECK_GE(epoll_ctl(epfd_, EPOLL_CTL_ADD, listen_sockfd_, &ev), 0) << "Failed to watch listen socket";
+}
+
+Reactor::~Reactor() { close(epfd_); }
+
+void Reactor::run() {
+    struct epoll_event events[kMaxEvents];
+    while (1) {
+        int32_t n = epoll_wait(epfd_, events, kMaxEvents, kSweepMs);
+        if (n < 0 && errno != EINTR) {
+            LOG(WARNING) << "epoll_wait() failed";
+        }
+
+        for (int32_t i = 0; i < n; ++i) {
+            int32_t fd = events[i].data.fd;
+            if (fd == listen_sockfd_) {
+                acceptAll();
+                continue;
+            }
+
+            auto it = sessions_.find(fd);
+            if (it == sessions_.end()) {
+                continue;
+            }
+            // keep the session alive while handling it, drop() may erase it
+            std::shared_ptr<Session> session = it->second;
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                readAll(session);
+            }
+            if (events[i].events & EPOLLOUT) {
+                std::lock_guard<std::mutex> lock(session->out_mutex_);
+                if (!session->broken_ && !session->flushLocked()) {
+                    LOG(WARNING) << "Failed to send back";
+                }
+            }
+        }
+
+        evictIdle();
+    }
+}
+
+void Reactor::acceptAll() {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int32_t client_sockfd =
+            accept4(listen_sockfd_, (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sockfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // EAGAIN: the backlog is drained. Anything else (e.g. EMFILE) is
+            // retried on the next edge rather than spinning here.
+            return;
+        }
+        LOG(INFO) << "Recieved connection from " << inet_ntoa(client_addr.sin_addr);
+
+        int opt = 1;
+        setsockopt(client_sockfd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+
+        struct epoll_event ev;
+        ev.events  = kSessionEvs;
+        ev.data.fd = client_sockfd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, client_sockfd, &ev) < 0) {
+            close(client_sockfd);
+            continue;
+        }
+        sessions_[client_sockfd] = std::make_shared<Session>(client_sockfd);
+    }
+}
+
+void Reactor::readAll(const std::shared_ptr<Session>& session) {
+    session->last_active_ = std::chrono::steady_clock::now();
+
+    // edge-triggered: read until the kernel buffer is empty
+    while (1) {
+        ssize_t got = session->in_.fill(session->sockfd_);
+        if (got == 0) {
+            drop(session->sockfd_);
+            return;
+        }
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                drop(session->sockfd_);
+            }
+            return;
+        }
+
+        // frames point into the session buffer, the next fill() reuses it
+        const uint8_t* body;
+        size_t size;
+        uint8_t version;
+        int32_t status;
+        while ((status = session->in_.next(&body, &size, &version)) == 1) {
+            BufferPool::Buffer frame = BufferPool::Instance().acquire();
+            frame->assign((const char*)body, size);
+            on_frame_(session, version, std::move(frame));
+        }
+        if (status < 0) {
+            LOG(ERROR) << "Invalid hash request header";
+            drop(session->sockfd_);
+            return;
+        }
+    }
+}
+
+void Reactor::drop(int32_t sockfd) {
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, sockfd, nullptr);
+    auto it = sessions_.find(sockfd);
+    if (it != sessions_.end()) {
+        {
+            std::lock_guard<std::mutex> lock(it->second->out_mutex_);
+            it->second->broken_ = true;
+        }
+        // workers still replying hold a reference, the fd closes with the last one
+        sessions_.erase(it);
+    }
+}
+
+void Reactor::evictIdle() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_sweep_ < std::chrono::milliseconds(kSweepMs)) {
+        return;
+    }
+    last_sweep_ = now;
+
+    auto deadline = now - std::chrono::milliseconds(kSessionTimeoutMs);
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+        auto session = (it++)->second;
+        if (session->last_active_ < deadline) {
+            drop(session->sockfd_);
+        }
+    }
+}
+
+}  // namespace chord
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "buffer_pool.h"
+#include "connection_pool.h"
+#include "frame_buffer.h"
+
+namespace chord {
+
+/*! \brief sessions without traffic for this long are closed, they outlive pooled client sockets. */
+const int32_t kSessionTimeoutMs = 2 * kIdleTimeoutMs;
+
+/**
+ * \brief  one accepted connection of the reactor. Incoming bytes are parsed
+ *         incrementally into frames of [uint64 size][body], where size counts
+ *         the 8-byte header too, so a partial frame never blocks the loop.
+ */
+class Session {
+   public:
+    explicit Session(int32_t sockfd);
+    ~Session();
+
+    /**
+     * \brief  frames and sends binary as an envelope of version. Safe to call from any thread. When
+     *         nothing is queued, header and body are written straight from
+     *         the caller's memory; whatever the socket does not take right
+     *         away is queued and flushed by the reactor once it becomes
+     *         writable again.
+     * \return false if the connection is broken.
+     */
+    bool send(const std::string& binary, uint8_t version);
+
+    int32_t sockfd() const { return sockfd_; }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+   private:
+    friend class Reactor;
+
+    /*! \brief writes out pending bytes, expects out_mutex_ to be held. */
+    bool flushLocked();
+
+    int32_t sockfd_;
+    std::chrono::steady_clock::time_point last_active_;
+
+    // read side, only touched by the reactor thread
+    FrameBuffer in_;
+
+    // write side, shared with the workers replying on this session
+    std::mutex out_mutex_;
+    std::string out_;
+    size_t out_pos_;
+    bool broken_;
+};
+
+/*! \brief receives every complete frame body, its envelope version and the session it arrived on. */
+typedef std::function<void(const std::shared_ptr<Session>&, uint8_t, BufferPool::Buffer&&)> FrameHandler;
+
+/**
+ * \brief  edge-triggered epoll loop over a listening socket and all of its
+ *         accepted connections. Sockets are non-blocking, one thread serves
+ *         every connection, and complete frames are handed to on_frame.
+ */
+class Reactor {
+   public:
+    Reactor(int32_t listen_sockfd, FrameHandler on_frame);
+    ~Reactor();
+
+    /*! \brief runs the event loop on the calling thread, never returns. */
+    void run();
+
+   private:
+    void acceptAll();
+    void readAll(const std::shared_ptr<Session>& session);
+    void drop(int32_t sockfd);
+    void evictIdle();
+
+    int32_t epfd_;
+    int32_t listen_sockfd_;
+    FrameHandler on_frame_;
+    std::unordered_map<int32_t, std::shared_ptr<Session>> sessions_;
+    std::chrono::steady_clock::time_point last_sweep_;
+};
+
+}  // namespace chord
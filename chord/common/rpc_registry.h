@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include <glog/logging.h>
+#include <google/protobuf/descriptor.h>
+
+#include "proto/chord.pb.h"
+
+namespace chord {
+
+/**
+ * \brief  maps numeric method ids to typed handlers. A method id is the field
+ *         number of its request and response in the Request and Response
+ *         oneofs, so a handler only sees its own typed messages, and dispatch
+ *         is an index into a table.
+ */
+class RpcRegistry {
+   public:
+    typedef std::function<bool(const protocol::Request&, protocol::Response*)> Handler;
+
+    /**
+     * \brief  registers handler(req, ctx, resp) as method, ctx is passed on
+     *         every call. The handler returns false for a request it cannot
+     *         serve, such as a malformed id.
+     */
+    template <typename Req, typename Ctx, typename Resp>
+    void add(uint32_t method, bool (*handler)(const Req&, Ctx, Resp*), Ctx ctx);
+
+    /**
+     * \brief  runs the handler of the method in the body of request.
+     * \return false for unknown methods and requests the handler refused,
+     *         response->success() tells the caller the same.
+     */
+    bool dispatch(const protocol::Request& request, protocol::Response* response) const {
+        uint32_t method = request.body_case();
+        if (method >= handlers_.size() || !handlers_[method]) {
+            response->set_success(false);
+            return false;
+        }
+        bool ok = handlers_[method](request, response);
+        response->set_success(ok);
+        return ok;
+    }
+
+   private:
+    std::vector<Handler> handlers_;
+};
+
+template <typename Req, typename Ctx, typename Resp>
+void RpcRegistry::add(uint32_t method, bool (*handler)(const Req&, Ctx, Resp*), Ctx ctx) {
+    const google::protobuf::FieldDescriptor* req_field  = protocol::Request::descriptor()->FindFieldByNumber(method);
+    const google::protobuf::FieldDescriptor* resp_field = protocol::Response::descriptor()->FindFieldByNumber(method);
+    CHECK(req_field != nullptr && req_field->message_type() == Req::descriptor())
+        << "Method " << method << " does not take " << Req::descriptor()->name();
+    CHECK(resp_field != nullptr && resp_field->message_type() == Resp::descriptor())
+        << "Method " << method << " does not return " << Resp::descriptor()->name();
+
+    if (method >= handlers_.size()) {
+        handlers_.resize(method + 1);
+    }
+    CHECK(!handlers_[method]) << "Method " << method << " is registered twice";
+
+    handlers_[method] = [handler, ctx, req_field, resp_field](const protocol::Request& request,
+                                                               protocol::Response* response) {
+        const Req& req = static_cast<const Req&>(request.GetReflection()->GetMessage(request, req_field));
+        Resp* resp     = static_cast<Resp*>(response->GetReflection()->MutableMessage(response, resp_field));
+        return handler(req, ctx, resp);
+    };
+}
+
+}  // namespace chord
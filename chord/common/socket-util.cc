@@ -1,8 +1,12 @@
 #include <errno.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
+#include "frame_buffer.h"
+#include "net-buffer.h"
 #include "socket-util.h"
 
 namespace chord {
@@ -33,6 +37,44 @@ ssize_t send_exact(int sockfd, void *buf, size_t len, int flags) {
     return total_sent;
 }
 
+ssize_t send_frame(int sockfd, const void *body, size_t len, uint8_t version, int flags) {
+    uint64_t header = htonll(frame_header(len, version));
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len  = sizeof(uint64_t);
+    iov[1].iov_base = const_cast<void *>(body);
+    iov[1].iov_len  = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+
+    size_t total_sent = 0;
+    ssize_t curr_sent;
+    while (total_sent < len + sizeof(uint64_t)) {
+        if ((curr_sent = sendmsg(sockfd, &msg, flags)) <= 0) {
+            if (curr_sent < 0 && errno == EINTR) {
+                continue;
+            }
+            return curr_sent;
+        }
+        total_sent += curr_sent;
+
+        // skip what went out, a short write can end inside either iovec
+        while (msg.msg_iovlen > 0 && (size_t)curr_sent >= msg.msg_iov->iov_len) {
+            curr_sent -= msg.msg_iov->iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + curr_sent;
+            msg.msg_iov->iov_len -= curr_sent;
+        }
+    }
+    return total_sent;
+}
+
 ssize_t send_file(int sockfd, FILE *data_file, size_t len, int flags) {
     uint8_t data_buf[SEND_FILE_CHUNK_SIZE];
 
@@ -58,7 +100,7 @@ size_t buffered_bytes(int sockfd) {
     return bytes_buffered;
 }
 
-bool socket_online(int sockfd) {
+bool socket_connected(int sockfd) {
     /* Check for socket disconnects */
     uint8_t test_recv;
     ssize_t recv_status = recv(sockfd, &test_recv, 1, MSG_NOSIGNAL | MSG_PEEK | MSG_DONTWAIT);
@@ -29,6 +29,17 @@ ssize_t recv_exact(int sockfd, void *buf, size_t len, int flags);
  */
 ssize_t send_exact(int sockfd, void *buf, size_t len, int flags);
 
+/**
+ *  Sends a frame of [uint64 header][body], the header holds the envelope
+ *  version and the frame size including itself (see frame_header()). Header
+ *  and body go out as separate iovecs of one sendmsg(), so the body is never
+ *  copied into a staging buffer.
+ *  Return value will be the number of bytes sent (len + 8) on SUCCESS.
+ *  Return value will be 0 if the socket is closed.
+ *  Return value will be -1 on ERROR.
+ */
+ssize_t send_frame(int sockfd, const void *body, size_t len, uint8_t version, int flags);
+
 /**
  * Returns the size read/sent on SUCCESS
  * Returns -1 if an error occurred sending the data
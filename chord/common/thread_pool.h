@@ -1,133 +1,563 @@
 #pragma once
 
+#include <stdint.h>
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <functional>
-#include <iostream>
-#include <list>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "callable.h"
+#include "futex.h"
 
 namespace chord {
 
+/*! \brief rounds a blocked Put or Take retries before it sleeps. */
+const int kQueueSpins = 64;
+
+/**
+ * \brief  a bounded multi-producer multi-consumer queue on a ring of
+ *         power-of-two slots, after Vyukov's bounded MPMC queue. Producers
+ *         and consumers claim a slot with one CAS on their own, cache-line
+ *         padded, position and meet only on the sequence number of that
+ *         slot. Elements are moved in and out, so T may be move-only, such
+ *         as Callable.
+ *
+ *         Put blocks while the queue is full and Take while it is empty,
+ *         sleeping on a futex after a short spin. The other side only makes
+ *         the wake-up syscall when someone is sleeping.
+ */
 template <typename T>
 class SyncQueue {
    public:
-    SyncQueue(int maxSize) : maxSize_(maxSize), needStop_(false) {}
+    /*! \brief maxSize is rounded up to a power of two. */
+    explicit SyncQueue(int maxSize)
+        : head_(0),
+          tail_(0),
+          capacity_(RoundUp(maxSize)),
+          mask_(capacity_ - 1),
+          slots_(new Slot[capacity_]),
+          needStop_(false),
+          takers_(0),
+          putters_(0),
+          putSeq_(0),
+          takeSeq_(0) {
+        for (size_t i = 0; i < capacity_; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~SyncQueue() {
+        T t;
+        while (TryTake(t)) {
+        }
+    }
 
-    void Put(const T& x) { Add(x); }
-    void Put(T&& x) { Add(std::forward<T>(x)); }
+    SyncQueue(const SyncQueue&) = delete;
+    SyncQueue& operator=(const SyncQueue&) = delete;
 
-    void Take(T& t) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        notEmpty_.wait(lock, [this] { return needStop_ || NotEmpty(); });
-        if (needStop_) return;
-        t = queue_.front();
-        queue_.pop_front();
-        notFull_.notify_one();
+    /*! \return false if the queue was stopped, x is not queued then. */
+    bool Put(const T& x) { return Add(x); }
+    bool Put(T&& x) { return Add(std::move(x)); }
+
+    /*! \brief false if the queue is full. */
+    bool TryPut(const T& x) { return TryAdd(x); }
+    bool TryPut(T&& x) { return TryAdd(std::move(x)); }
+
+    /*! \return false if the queue was stopped, t is left alone then. */
+    bool Take(T& t) {
+        return Wait(&takeSeq_, &takers_, [this, &t] { return TryTake(t); });
     }
 
-    void Stop() {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            needStop_ = true;
+    /*! \brief false if the queue is empty. */
+    bool TryTake(T& t) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (1) {
+            slot        = &slots_[pos & mask_];
+            size_t seq  = slot->seq.load(std::memory_order_acquire);
+            intptr_t df = intptr_t(seq) - intptr_t(pos + 1);
+            if (df == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (df < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
         }
-        notFull_.notify_all();
-        notEmpty_.notify_all();
-    }
-    bool Empty() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.empty();
+        T* item = slot->item();
+        t       = std::move(*item);
+        item->~T();
+        // the slot is free for the producer one lap ahead
+        slot->seq.store(pos + capacity_, std::memory_order_release);
+        Notify(&putSeq_, &putters_);
+        return true;
     }
-    bool Full() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.size() == maxSize_;
+
+    /*! \brief wakes everyone blocked in Put or Take, they and later ones return false. */
+    void Stop() {
+        needStop_ = true;
+        putSeq_.fetch_add(1);
+        takeSeq_.fetch_add(1);
+        futex_wake(&putSeq_, INT32_MAX);
+        futex_wake(&takeSeq_, INT32_MAX);
     }
-    size_t Size() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.size();
+
+    bool Empty() const { return Size() == 0; }
+    bool Full() const { return Size() >= capacity_; }
+    /*! \brief a snapshot, elements may come and go meanwhile. */
+    size_t Size() const {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
     }
-    int Count() { return queue_.size(); }
+    int Count() const { return Size(); }
 
    private:
-    bool NotFull() const {
-        bool full = queue_.size() >= maxSize_;
-        return !full;
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T* item() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    static size_t RoundUp(int size) {
+        size_t capacity = 2;
+        while (capacity < size_t(size)) {
+            capacity <<= 1;
+        }
+        return capacity;
     }
-    bool NotEmpty() const {
-        bool empty = queue_.empty();
-        return !empty;
+
+    template <typename F>
+    bool TryAdd(F&& x) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (1) {
+            slot        = &slots_[pos & mask_];
+            size_t seq  = slot->seq.load(std::memory_order_acquire);
+            intptr_t df = intptr_t(seq) - intptr_t(pos);
+            if (df == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (df < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        new (slot->item()) T(std::forward<F>(x));
+        slot->seq.store(pos + 1, std::memory_order_release);
+        Notify(&takeSeq_, &takers_);
+        return true;
     }
 
     template <typename F>
-    void Add(F&& x) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        notFull_.wait(lock, [this]() { return needStop_ || NotFull(); });
-        if (needStop_) return;
-        queue_.push_back(std::forward<F>(x));
-        notEmpty_.notify_one();
+    bool Add(F&& x) {
+        return Wait(&putSeq_, &putters_, [this, &x] { return TryAdd(std::forward<F>(x)); });
     }
 
-   private:
-    std::list<T> queue_;
-    std::mutex mutex_;
-    std::condition_variable notEmpty_;
-    std::condition_variable notFull_;
-    int maxSize_;
-    bool needStop_;
+    /**
+     * \brief  retries attempt until it succeeds or the queue stops, spinning
+     *         first and then sleeping on seq, which the other side bumps.
+     */
+    template <typename F>
+    bool Wait(std::atomic<uint32_t>* seq, std::atomic<int>* sleepers, F attempt) {
+        for (int spin = 0; !needStop_; ++spin) {
+            if (attempt()) {
+                return true;
+            }
+            if (spin < kQueueSpins) {
+                std::this_thread::yield();
+                continue;
+            }
+            uint32_t current = seq->load();
+            sleepers->fetch_add(1);
+            // pairs with the fence in Notify, either we see its change or it sees us
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool done = !needStop_ && attempt();
+            if (!done && !needStop_) {
+                futex_wait(seq, current);
+            }
+            sleepers->fetch_sub(1);
+            if (done) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Notify(std::atomic<uint32_t>* seq, std::atomic<int>* sleepers) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers->load(std::memory_order_relaxed) > 0) {
+            seq->fetch_add(1);
+            futex_wake(seq, 1);
+        }
+    }
+
+    std::atomic<size_t> head_;
+    char headPad_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+    char tailPad_[64 - sizeof(std::atomic<size_t>)];
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic_bool needStop_;
+
+    // threads sleeping in Take and in Put, and the futex words that wake them
+    std::atomic<int> takers_;
+    std::atomic<int> putters_;
+    std::atomic<uint32_t> putSeq_;
+    std::atomic<uint32_t> takeSeq_;
 };
 
-const int g_maxThreadCnt = 100;
+/*! \brief tasks the shared queue of a pool holds, adding from outside the pool blocks beyond. */
+const int kInjectQueueSize = 4096;
+/*! \brief tasks a worker deque holds, more go to the shared queue. */
+const int64_t kWorkerDequeSize = 1024;
+/*! \brief rounds an idle worker looks for work before it parks. */
+const int kStealRounds = 4;
+
+/**
+ * \brief  the deque of one worker, after Chase-Lev as in "Correct and
+ *         Efficient Work-Stealing for Weak Memory Models". The owner pushes
+ *         and pops at the bottom without locking, any thread steals from the
+ *         top with a CAS. The capacity is fixed, push fails when it is full.
+ *
+ *         Tasks are held by value, so queueing one allocates nothing. Since
+ *         a thief may only touch a slot once its CAS won it, it moves the
+ *         task out afterwards, and each slot carries a sequence number, as
+ *         in SyncQueue, that frees it for the push one lap ahead only when
+ *         that is done.
+ */
+template <typename T>
+class WorkStealingDeque {
+   public:
+    explicit WorkStealingDeque(int64_t capacity)
+        : top_(0), bottom_(0), mask_(capacity - 1), slots_(new Slot[capacity]) {
+        for (int64_t i = 0; i < capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~WorkStealingDeque() {
+        T item;
+        while (Pop(&item)) {
+        }
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /*! \brief owner only, item is moved in, and left alone if the deque is full. */
+    bool Push(T&& item) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top    = top_.load(std::memory_order_acquire);
+        if (bottom - top > mask_) {
+            return false;
+        }
+        Slot* slot = &slots_[bottom & mask_];
+        if (slot->seq.load(std::memory_order_acquire) != bottom) {
+            // a thief is still moving out the task of the lap before
+            return false;
+        }
+        new (slot->item()) T(std::move(item));
+        // publishes the task to thieves, who load bottom_ with acquire
+        bottom_.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*! \brief owner only, moves the task pushed last into item. */
+    bool Pop(T* item) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        if (top == bottom) {
+            // the last one, a thief may be taking it too
+            bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            if (!won) {
+                return false;
+            }
+            // top_ moved past this index as in Steal
+            Take(bottom, bottom + mask_ + 1, item);
+            return true;
+        }
+        // the next push reuses this index
+        Take(bottom, bottom, item);
+        return true;
+    }
+
+    /*! \brief any thread, moves the task pushed first into item, false if empty or another thread won it. */
+    bool Steal(T* item) {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return false;
+        }
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        // top_ moved past this index, the slot comes round again one lap ahead
+        Take(top, top + mask_ + 1, item);
+        return true;
+    }
+
+    bool Empty() const { return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed); }
+
+   private:
+    struct Slot
+    {
+        std::atomic<int64_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T* item() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    /*! \brief moves out the task at index, which the caller won, and frees its slot for the push at next. */
+    void Take(int64_t index, int64_t next, T* item) {
+        Slot* slot = &slots_[index & mask_];
+        *item      = std::move(*slot->item());
+        slot->item()->~T();
+        slot->seq.store(next, std::memory_order_release);
+    }
 
+    // top_ is written by thieves and bottom_ by the owner, kept on separate lines
+    std::atomic<int64_t> top_;
+    char pad_[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> bottom_;
+    int64_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+/**
+ * \brief  a work-stealing pool. Every worker runs tasks from its own deque,
+ *         newest first, so a task added from a worker (a handler spawning
+ *         follow-up work) stays on that thread without touching shared
+ *         state. Tasks added from other threads go to a shared SyncQueue
+ *         that workers drain in batches into their deques. A worker out of work
+ *         steals the oldest task of a random other worker, and after
+ *         kStealRounds empty rounds parks until a task is added; adding a
+ *         task only pays for a wakeup when some worker is parked.
+ */
 class threadpool {
    public:
-    using Task = std::function<void()>;
-    threadpool(int numThreads = std::thread::hardware_concurrency()) : queue_(g_maxThreadCnt) { Start(numThreads); }
+    using Task = Callable;
+    /*! \brief capacity bounds the shared queue, what AddTask() from outside the pool waits on. */
+    threadpool(int numThreads = std::thread::hardware_concurrency(), int capacity = kInjectQueueSize)
+        : running_(true), injected_(capacity), parked_(0), wakeups_(0) {
+        Start(std::max(numThreads, 1));
+    }
 
     ~threadpool() { Stop(); }
 
+    /*! \brief joins the workers, tasks not started by then are dropped. */
     void Stop() {
         std::call_once(flag_, [this] { StopThreadGroup(); });
     }
 
-    void AddTask(Task&& task) { queue_.Put(std::forward<Task>(task)); }
+    /*! \brief a task of up to kCallableInline bytes is queued without an allocation. */
+    void AddTask(Task task) { Add(std::move(task), true); }
+
+    /**
+     * \brief  AddTask() that never blocks, for a thread that must not wait
+     *         on the workers, such as a reactor.
+     * \return false if the shared queue is full, the task is dropped then.
+     */
+    bool TryAddTask(Task task) { return Add(std::move(task), false); }
 
-    void AddTask(const Task& task) { queue_.Put(task); }
+    /*! \brief whether a task added from outside the pool finds the shared queue full. */
+    bool Full() const { return injected_.Full(); }
 
    private:
+    struct Worker
+    {
+        explicit Worker(int i) : index(i), deque(kWorkerDequeSize), seed(i + 1) {}
+
+        int index;
+        WorkStealingDeque<Task> deque;
+        uint32_t seed;
+        std::thread thread;
+    };
+
+    /*! \brief the worker of this pool running on the calling thread, if any. */
+    Worker* Current() const {
+        const std::pair<const threadpool*, Worker*>& current = CurrentSlot();
+        return current.first == this ? current.second : nullptr;
+    }
+
+    static std::pair<const threadpool*, Worker*>& CurrentSlot() {
+        static thread_local std::pair<const threadpool*, Worker*> current(nullptr, nullptr);
+        return current;
+    }
+
     void Start(int numThreads) {
-        running_ = true;
-        // create threads
         for (int i = 0; i < numThreads; ++i) {
-            threadgroup_.push_back(std::make_shared<std::thread>(&threadpool::RunInThread, this));
+            workers_.emplace_back(new Worker(i));
+        }
+        // all workers exist before any of them looks for a victim
+        for (auto& worker : workers_) {
+            worker->thread = std::thread(&threadpool::RunInThread, this, worker.get());
         }
     }
 
-    void RunInThread() {
+    /*! \brief wait tells whether a thread outside the pool waits for room in the shared queue. */
+    bool Add(Task&& task, bool wait) {
+        Worker* worker = Current();
+        if (worker) {
+            // both leave task alone when there is no room
+            if (!worker->deque.Push(std::move(task)) && !injected_.TryPut(std::move(task))) {
+                // waiting for room would wait on ourselves
+                task();
+                return true;
+            }
+        } else if (wait ? !injected_.Put(std::move(task)) : !injected_.TryPut(std::move(task))) {
+            return false;
+        }
+        // pairs with the fence in Park, either the worker sees the task or we see the worker
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_.load(std::memory_order_relaxed) > 0) {
+            {
+                std::lock_guard<std::mutex> lock(parkMutex_);
+                ++wakeups_;
+            }
+            parkCv_.notify_one();
+        }
+        return true;
+    }
+
+    /*! \brief takes a share of the shared queue into the deque of worker, and one of them into task. */
+    bool TakeInjected(Worker* worker, Task* task) {
+        if (!injected_.TryTake(*task)) {
+            return false;
+        }
+        // leave the rest for the other workers to take their share, the deque is empty here
+        size_t batch = std::min<size_t>(injected_.Size() / workers_.size(), kWorkerDequeSize / 2);
+        Task next;
+        while (batch-- > 0 && injected_.TryTake(next)) {
+            if (!worker->deque.Push(std::move(next))) {
+                // a slot still being stolen from
+                Add(std::move(next), true);
+            }
+        }
+        return true;
+    }
+
+    bool Steal(Worker* worker, Task* task) {
+        size_t count = workers_.size();
+        worker->seed = worker->seed * 1103515245 + 12345;
+        size_t start = (worker->seed >> 16) % count;
+        for (size_t i = 0; i < count; ++i) {
+            Worker* victim = workers_[(start + i) % count].get();
+            if (victim == worker) {
+                continue;
+            }
+            if (victim->deque.Steal(task)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Next(Worker* worker, Task* task) {
+        return worker->deque.Pop(task) || TakeInjected(worker, task) || Steal(worker, task);
+    }
+
+    bool HasWork() const {
+        if (!injected_.Empty()) {
+            return true;
+        }
+        for (auto& worker : workers_) {
+            if (!worker->deque.Empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Park() {
+        std::unique_lock<std::mutex> lock(parkMutex_);
+        uint64_t wakeups = wakeups_;
+        parked_.fetch_add(1, std::memory_order_relaxed);
+        lock.unlock();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // a task added before we counted as parked is seen here, one added after rings wakeups_
+        if (running_ && !HasWork()) {
+            lock.lock();
+            parkCv_.wait(lock, [this, wakeups] { return wakeups_ != wakeups || !running_; });
+            lock.unlock();
+        }
+        parked_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void RunInThread(Worker* worker) {
+        CurrentSlot() = std::make_pair(this, worker);
+        int idle      = 0;
         while (running_) {
+            // a task's captures go with it once it ran
             Task task;
-            queue_.Take(task);
-            if (!running_) return;
-            task();
+            if (Next(worker, &task)) {
+                idle = 0;
+                task();
+            } else if (++idle < kStealRounds) {
+                std::this_thread::yield();
+            } else {
+                idle = 0;
+                Park();
+            }
         }
+        CurrentSlot() = std::make_pair(nullptr, nullptr);
     }
 
     void StopThreadGroup() {
-        running_ = false;
-        queue_.Stop();
-        for (auto thread : threadgroup_) {
-            if (thread) {
-                thread->join();
+        {
+            std::lock_guard<std::mutex> lock(parkMutex_);
+            running_ = false;
+        }
+        parkCv_.notify_all();
+        injected_.Stop();
+        for (auto& worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+        Task task;
+        for (auto& worker : workers_) {
+            while (worker->deque.Pop(&task)) {
             }
         }
-        threadgroup_.clear();
+        while (injected_.TryTake(task)) {
+        }
     }
 
-    std::list<std::shared_ptr<std::thread>> threadgroup_;
-    SyncQueue<Task> queue_;
+    std::vector<std::unique_ptr<Worker>> workers_;
     std::atomic_bool running_;
     std::once_flag flag_;
+
+    SyncQueue<Task> injected_;
+
+    // parked_ counts workers parked or about to, wakeups_ is bumped under parkMutex_ to wake them
+    std::atomic<int> parked_;
+    std::mutex parkMutex_;
+    std::condition_variable parkCv_;
+    uint64_t wakeups_;
 };
 
-}  // namespace chord
\ No newline at end of file
+}  // namespace chord
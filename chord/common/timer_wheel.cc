@@ -0,0 +1,255 @@
+#include <glog/logging.h>
+#include <algorithm>
+#include <iomanip>
+
+#include "timer_wheel.h"
+
+namespace chord {
+
+namespace {
+// 4 levels of 64 slots cover 2^24 ticks, timers further out are filed at the
+// top and cascade through it again until they are in reach
+const int kWheelBits     = 6;
+const int kWheelSlots    = 1 << kWheelBits;
+const int kWheelLevels   = 4;
+const int64_t kWheelSpan = int64_t(1) << (kWheelBits * kWheelLevels);
+
+int slot_of(int level, int64_t tick) {
+    return level * kWheelSlots + ((tick >> (kWheelBits * level)) & (kWheelSlots - 1));
+}
+
+void raise_to(std::atomic<int64_t>* max, int64_t value) {
+    int64_t current = *max;
+    while (value > current && !max->compare_exchange_weak(current, value)) {
+    }
+}
+}  // namespace
+
+TimerWheel& TimerWheel::Instance() {
+    static TimerWheel wheel;
+    return wheel;
+}
+
+TimerWheel::TimerWheel()
+    : stop_(false),
+      nextId_(1),
+      start_(Clock::now()),
+      now_(0),
+      slots_(kWheelLevels * kWheelSlots),
+      workers_(kTimerWorkers) {}
+
+TimerWheel::~TimerWheel() {
+    if (!stop_) {
+        shutdown();
+    }
+}
+
+int TimerWheel::createAsync(const std::string& name, int interval_ms, bool repeat,
+                            std::function<void(std::function<void()> done)> f) {
+    return add(name, interval_ms, repeat, nullptr, std::move(f));
+}
+
+int TimerWheel::add(const std::string& name, int interval_ms, bool repeat, std::function<void()> handler,
+                    std::function<void(std::function<void()>)> start) {
+    auto timer        = std::make_shared<Timer>();
+    timer->name       = name;
+    timer->interval   = std::max<int64_t>(1, interval_ms / kTimerTickMs);
+    timer->repeat     = repeat;
+    timer->handler    = std::move(handler);
+    timer->start      = std::move(start);
+    timer->generation = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        timer->id          = nextId_++;
+        timer->due         = std::max(now_, ticks(true)) + timer->interval;
+        timers_[timer->id] = timer;
+        file(timer);
+    }
+    // the loop may be sleeping past the new timer
+    cv_.notify_one();
+    return timer->id;
+}
+
+bool TimerWheel::cancel(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timers_.find(id);
+    if (it == timers_.end()) {
+        return false;
+    }
+    ++it->second->generation;
+    timers_.erase(it);
+    return true;
+}
+
+bool TimerWheel::setInterval(int id, int interval_ms) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = timers_.find(id);
+        if (it == timers_.end()) {
+            return false;
+        }
+        const TimerPtr& timer = it->second;
+        timer->interval       = std::max<int64_t>(1, interval_ms / kTimerTickMs);
+
+        int64_t due = std::max(now_, ticks(true)) + timer->interval;
+        if (due >= timer->due) {
+            return true;
+        }
+        timer->due = due;
+        file(timer);
+    }
+    cv_.notify_one();
+    return true;
+}
+
+int TimerWheel::timerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        // catch up tick by tick, a late loop fires everything it overslept
+        std::vector<std::function<void()>> runs;
+        for (int64_t target = ticks(); now_ < target;) {
+            ++now_;
+            for (int level = kWheelLevels - 1; level > 0; --level) {
+                if ((now_ & ((int64_t(1) << (kWheelBits * level)) - 1)) == 0) {
+                    cascade(level);
+                }
+            }
+            std::vector<Entry> due;
+            due.swap(slots_[slot_of(0, now_)]);
+            for (auto& entry : due) {
+                const TimerPtr& timer = entry.first;
+                if (entry.second != timer->generation) {
+                    continue;
+                }
+                if (timer->due > now_) {
+                    file(timer);
+                } else {
+                    fire(timer, &runs);
+                }
+            }
+        }
+        if (!runs.empty()) {
+            // a handler may add a timer
+            lock.unlock();
+            for (auto& run : runs) {
+                workers_.AddTask(std::move(run));
+            }
+            lock.lock();
+            continue;
+        }
+
+        if (timers_.empty()) {
+            cv_.wait(lock);
+        } else {
+            cv_.wait_until(lock, start_ + std::chrono::milliseconds(nextWakeup() * kTimerTickMs));
+        }
+    }
+    return 0;
+}
+
+void TimerWheel::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    workers_.Stop();
+}
+
+void TimerWheel::report(std::ostream& out) {
+    std::vector<TimerPtr> timers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& it : timers_) {
+            timers.push_back(it.second);
+        }
+    }
+    std::sort(timers.begin(), timers.end(), [](const TimerPtr& a, const TimerPtr& b) { return a->id < b->id; });
+
+    std::ios::fmtflags flags  = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    for (auto& timer : timers) {
+        uint64_t runs = timer->runs;
+        double mean   = runs == 0 ? 0 : timer->total_lag_us / 1000.0 / runs;
+        out << "< Timer " << timer->name << " every " << timer->interval * kTimerTickMs << " ms " << runs << " runs "
+            << timer->skipped << " skipped lag " << timer->last_lag_us / 1000.0 << " ms mean " << mean << " ms max "
+            << timer->max_lag_us / 1000.0 << " ms" << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+int64_t TimerWheel::ticks(bool round_up) const {
+    std::chrono::milliseconds tick(kTimerTickMs);
+    Clock::duration elapsed = Clock::now() - start_;
+    return round_up ? (elapsed + tick - Clock::duration(1)) / tick : elapsed / tick;
+}
+
+void TimerWheel::file(const TimerPtr& timer) {
+    // only a cascade files a timer due now, before the slot of now is fired
+    int64_t due   = std::max(timer->due, now_);
+    int64_t delta = std::min(due - now_, kWheelSpan - 1);
+    int level     = 0;
+    while (delta >= (int64_t(1) << (kWheelBits * (level + 1)))) {
+        ++level;
+    }
+    slots_[slot_of(level, std::min(due, now_ + kWheelSpan - 1))].push_back(Entry(timer, ++timer->generation));
+}
+
+void TimerWheel::cascade(int level) {
+    std::vector<Entry> entries;
+    entries.swap(slots_[slot_of(level, now_)]);
+    for (auto& entry : entries) {
+        if (entry.second == entry.first->generation) {
+            file(entry.first);
+        }
+    }
+}
+
+void TimerWheel::fire(const TimerPtr& timer, std::vector<std::function<void()>>* runs) {
+    Clock::time_point due = start_ + std::chrono::milliseconds(timer->due * kTimerTickMs);
+    if (timer->repeat) {
+        // periods missed while the loop was late are dropped, not made up for
+        timer->due = std::max(timer->due + timer->interval, now_ + 1);
+        file(timer);
+    } else {
+        timers_.erase(timer->id);
+    }
+
+    if (timer->running.exchange(true)) {
+        ++timer->skipped;
+        return;
+    }
+    runs->push_back([timer, due] {
+        int64_t lag = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count();
+        timer->last_lag_us = lag;
+        timer->total_lag_us += lag;
+        raise_to(&timer->max_lag_us, lag);
+        ++timer->runs;
+        if (lag > kTimerLagWarnMs * 1000) {
+            LOG(WARNING) << "Timer " << timer->name << " started " << lag / 1000 << " ms late";
+        }
+
+        if (timer->start) {
+            timer->start([timer] { timer->running = false; });
+            return;
+        }
+        timer->handler();
+        timer->running = false;
+    });
+}
+
+int64_t TimerWheel::nextWakeup() const {
+    // the first slot of level 0 with timers, or the next cascade
+    int64_t boundary = ((now_ >> kWheelBits) + 1) << kWheelBits;
+    for (int64_t tick = now_ + 1; tick < boundary; ++tick) {
+        if (!slots_[slot_of(0, tick)].empty()) {
+            return tick;
+        }
+    }
+    return boundary;
+}
+
+}  // namespace chord
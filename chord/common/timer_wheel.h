@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace chord {
+
+/*! \brief the resolution of timers, and the threads their handlers run on. */
+const int32_t kTimerTickMs = 1;
+const int kTimerWorkers    = 4;
+
+/*! \brief a handler starting this much later than it was due is logged. */
+const int32_t kTimerLagWarnMs = 100;
+
+/**
+ * \brief  runs handlers after a delay, or every interval, on a fixed pool of
+ *         worker threads. Timers sit in a hierarchical timing wheel: level l
+ *         has kWheelSlots slots of kWheelSlots^l ticks each, a timer is filed
+ *         in the lowest level that reaches its due tick and moves down a level
+ *         whenever the level below wraps around. Adding, cancelling and firing
+ *         a timer is O(1) however many there are, and the loop sleeps until
+ *         the next slot holding work. Ticks are counted on steady_clock, so
+ *         adjusting the wall clock neither fires nor stalls timers.
+ *
+ *         A periodic timer whose last run has not returned skips its turn
+ *         instead of piling up runs, and every run records how late it started.
+ */
+class TimerWheel {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    static TimerWheel& Instance();
+
+    /**
+     * \brief  runs f(args...) in interval_ms, and every interval_ms after
+     *         that if repeat. name identifies the timer in report().
+     * \return the id of the timer, to cancel it.
+     */
+    template <class F, class... Args>
+    int create(const std::string& name, int interval_ms, bool repeat, F&& f, Args&&... args);
+
+    /**
+     * \brief  create() for a handler that completes later: f(done) starts a
+     *         run, and the run counts as in progress until it calls done(),
+     *         so a periodic timer skips its turns while one still waits.
+     * \return the id of the timer, to cancel it.
+     */
+    int createAsync(const std::string& name, int interval_ms, bool repeat,
+                    std::function<void(std::function<void()> done)> f);
+
+    /**
+     * \brief  stops the timer, a run in progress completes.
+     * \return false if there is no such timer.
+     */
+    bool cancel(int id);
+
+    /**
+     * \brief  changes the period of a repeating timer. A shorter one takes
+     *         effect at once, a longer one after the next run.
+     * \return false if there is no such timer.
+     */
+    bool setInterval(int id, int interval_ms);
+
+    /*! \brief advances the wheel and dispatches due timers until shutdown(). */
+    int timerLoop();
+    void shutdown();
+
+    /*! \brief prints the runs, skipped runs and start lag of every timer. */
+    void report(std::ostream& out);
+
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+   private:
+    TimerWheel();
+
+    struct Timer
+    {
+        int id;
+        std::string name;
+        int64_t interval;  // in ticks
+        bool repeat;
+        std::function<void()> handler;
+        // instead of handler for a timer of createAsync()
+        std::function<void(std::function<void()>)> start;
+        // guarded by mutex_: the due tick, and the count of times the timer
+        // was filed or cancelled, slots holding an older count are stale
+        int64_t due;
+        uint64_t generation;
+
+        // set while a run is queued or in progress
+        std::atomic<bool> running{false};
+        std::atomic<uint64_t> runs{0};
+        std::atomic<uint64_t> skipped{0};
+        std::atomic<int64_t> last_lag_us{0};
+        std::atomic<int64_t> max_lag_us{0};
+        std::atomic<int64_t> total_lag_us{0};
+    };
+    typedef std::shared_ptr<Timer> TimerPtr;
+    typedef std::pair<TimerPtr, uint64_t> Entry;
+
+    int add(const std::string& name, int interval_ms, bool repeat, std::function<void()> handler,
+            std::function<void(std::function<void()>)> start = nullptr);
+
+    /*! \brief whole ticks since the wheel started, or started ones if round_up, so a new timer never fires early. */
+    int64_t ticks(bool round_up = false) const;
+
+    /*! \brief files timer in the slot of its due tick. */
+    void file(const TimerPtr& timer);
+
+    /*! \brief moves the timers of a slot of level down to lower levels. */
+    void cascade(int level);
+
+    /**
+     * \brief  adds the run of timer for the workers to runs, or skips it if
+     *         the last run is still going, and files timer again if it repeats.
+     */
+    void fire(const TimerPtr& timer, std::vector<std::function<void()>>* runs);
+
+    /*! \brief the next tick that has timers to fire or to cascade. */
+    int64_t nextWakeup() const;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+    int nextId_;
+
+    Clock::time_point start_;
+    // the last tick processed
+    int64_t now_;
+    // kWheelLevels levels of kWheelSlots slots, stale entries are dropped when their slot comes up
+    std::vector<std::vector<Entry>> slots_;
+    std::unordered_map<int, TimerPtr> timers_;
+
+    threadpool workers_;
+};
+
+template <class F, class... Args>
+int TimerWheel::create(const std::string& name, int interval_ms, bool repeat, F&& f, Args&&... args) {
+    std::function<void()> handler = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    return add(name, interval_ms, repeat, std::move(handler));
+}
+
+}  // namespace chord
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <memory>
+
+#include "channel.h"
+
+namespace chord {
+
+/**
+ * \brief  how the connection pool reaches a peer. Everything above the pool
+ *         only sees channels, so a transport that delivers calls some other
+ *         way than TCP, e.g. to nodes in the same process, is all it takes to
+ *         run the protocol over it.
+ */
+class Transport {
+   public:
+    virtual ~Transport() {}
+
+    /*! \brief opens a channel to addr, or returns nullptr if the peer cannot be reached. */
+    virtual std::shared_ptr<Channel> connect(const struct sockaddr_in& addr) = 0;
+};
+
+/*! \brief a TCP connection per peer, the transport of a deployed node. */
+class TcpTransport : public Transport {
+   public:
+    std::shared_ptr<Channel> connect(const struct sockaddr_in& addr) override { return Channel::connect(addr); }
+};
+
+}  // namespace chord
@@ -0,0 +1,106 @@
+#include <math.h>
+#include <algorithm>
+
+#include "vivaldi.h"
+
+namespace chord {
+
+namespace {
+// how far a sample moves the coordinate, and the error estimate
+const double kVivaldiCc = 0.25;
+const double kVivaldiCe = 0.25;
+
+// heights never reach zero, or a node could not move out of the plane
+const double kMinHeight = 0.1;
+
+// samples above this are queueing, not distance
+const double kMaxRttMs = 10000;
+}  // namespace
+
+double Coordinate::rtt(const Coordinate& other) const {
+    double sum = 0;
+    for (int i = 0; i < kVivaldiDims; ++i) {
+        double d = x[i] - other.x[i];
+        sum += d * d;
+    }
+    return sqrt(sum) + height + other.height;
+}
+
+Coordinate Coordinate::fromProto(const protocol::Coordinate& coord) {
+    Coordinate c;
+    if (coord.x_size() != kVivaldiDims || !(coord.error() >= 0 && coord.error() < 1) || !(coord.height() >= 0)) {
+        return c;
+    }
+    for (int i = 0; i < kVivaldiDims; ++i) {
+        if (!std::isfinite(coord.x(i))) {
+            return Coordinate();
+        }
+        c.x[i] = coord.x(i);
+    }
+    c.height = coord.height();
+    c.error  = coord.error();
+    return c;
+}
+
+void Coordinate::toProto(protocol::Coordinate* coord) const {
+    coord->clear_x();
+    for (int i = 0; i < kVivaldiDims; ++i) {
+        coord->add_x(x[i]);
+    }
+    coord->set_height(height);
+    coord->set_error(error);
+}
+
+Vivaldi& Vivaldi::Instance() {
+    static Vivaldi vivaldi;
+    return vivaldi;
+}
+
+Coordinate Vivaldi::local() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return local_;
+}
+
+void Vivaldi::observe(const Coordinate& remote, double rtt_ms) {
+    if (!(rtt_ms > 0) || rtt_ms > kMaxRttMs) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Coordinate& self = local_;
+
+    // trust the sample by how sure both ends are of their coordinates
+    double w         = self.error / (self.error + remote.error);
+    double predicted = self.rtt(remote);
+    double sample    = fabs(predicted - rtt_ms) / rtt_ms;
+    double error     = sample * kVivaldiCe * w + self.error * (1 - kVivaldiCe * w);
+
+    // the unit vector from remote to this node, the height counts as a
+    // dimension whose difference is the sum of both heights
+    double dir[kVivaldiDims];
+    double length = 0;
+    for (int i = 0; i < kVivaldiDims; ++i) {
+        dir[i] = self.x[i] - remote.x[i];
+        length += dir[i] * dir[i];
+    }
+    length = sqrt(length);
+    if (length == 0) {
+        std::uniform_real_distribution<double> uniform(-1, 1);
+        for (int i = 0; i < kVivaldiDims; ++i) {
+            dir[i] = uniform(random_);
+            length += dir[i] * dir[i];
+        }
+        length = sqrt(length);
+    }
+    double norm = length + self.height + remote.height;
+
+    // move by the misprediction, outwards if too close and inwards if too far
+    double step = kVivaldiCc * w * (rtt_ms - predicted);
+    for (int i = 0; i < kVivaldiDims; ++i) {
+        self.x[i] += step * dir[i] / std::max(norm, 1e-9);
+    }
+    self.height = std::max(kMinHeight, self.height + step * (self.height + remote.height) / std::max(norm, 1e-9));
+    self.error  = std::min(error, 0.99);
+}
+
+}  // namespace chord
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <random>
+
+#include "proto/chord.pb.h"
+
+namespace chord {
+
+/*! \brief euclidean dimensions of a coordinate, a height is kept on top of them. */
+const int kVivaldiDims = 2;
+
+/**
+ * \brief  a synthetic network coordinate in milliseconds: the predicted RTT
+ *         between two nodes is the distance of their points plus both
+ *         heights, the height standing for the access link every packet of
+ *         a node crosses. error is the relative error of recent predictions,
+ *         1 for a node that has not measured anything yet.
+ */
+struct Coordinate
+{
+    float x[kVivaldiDims];
+    float height;
+    float error;
+
+    Coordinate() : height(0), error(1) {
+        for (int i = 0; i < kVivaldiDims; ++i) {
+            x[i] = 0;
+        }
+    }
+
+    /*! \brief true once the coordinate predicts anything. */
+    bool known() const { return error < 1; }
+
+    /*! \brief the predicted RTT to other in milliseconds. */
+    double rtt(const Coordinate& other) const;
+
+    /*! \brief reads a coordinate off the wire, a malformed one is left unknown. */
+    static Coordinate fromProto(const protocol::Coordinate& coord);
+
+    void toProto(protocol::Coordinate* coord) const;
+};
+
+/**
+ * \brief  the coordinate of this node, moved by every RTT sample towards
+ *         where the sample says it should be (Dabek et al., Vivaldi: A
+ *         Decentralized Network Coordinate System), by more the surer this
+ *         node is of the peer relative to itself.
+ */
+class Vivaldi {
+   public:
+    static Vivaldi& Instance();
+
+    Coordinate local();
+
+    /*! \brief updates the local coordinate from one RTT sample to a peer at remote. */
+    void observe(const Coordinate& remote, double rtt_ms);
+
+    Vivaldi(const Vivaldi&) = delete;
+    Vivaldi& operator=(const Vivaldi&) = delete;
+
+   private:
+    Vivaldi() {}
+
+    std::mutex mutex_;
+    Coordinate local_;
+    // a direction when both points coincide, as they do at start
+    std::mt19937 random_;
+};
+
+}  // namespace chord
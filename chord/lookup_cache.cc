@@ -0,0 +1,93 @@
+#include "lookup_cache.h"
+#include "common/bigint.h"
+
+namespace chord {
+
+bool LookupCache::find(const NodeId& id, NodeRef* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = containing(id);
+    if (it != ranges_.end() && it->second.expires < Clock::now()) {
+        erase(it);
+        it = ranges_.end();
+    }
+    if (it == ranges_.end()) {
+        ++misses_;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    *owner = it->second.owner;
+    ++hits_;
+    return true;
+}
+
+void LookupCache::insert(const NodeRef& pred, const NodeRef& owner) {
+    if (capacity_ == 0 || !pred.valid() || !owner.valid()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // a range overlapping the new one either ends inside it or holds its end
+    for (auto it = after(pred.id); it != ranges_.end() && within(it->first.data(), pred.id.data(), owner.id.data());
+         it = after(pred.id)) {
+        erase(it);
+    }
+    auto it = containing(owner.id);
+    if (it != ranges_.end()) {
+        erase(it);
+    }
+
+    lru_.push_front(owner.id);
+    Entry& entry  = ranges_[owner.id];
+    entry.lower   = pred.id;
+    entry.owner   = owner;
+    entry.expires = Clock::now() + ttl_;
+    entry.lru     = lru_.begin();
+
+    if (ranges_.size() > capacity_) {
+        erase(ranges_.find(lru_.back()));
+    }
+}
+
+void LookupCache::invalidate(const NodeId& node) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = containing(node);
+    if (it != ranges_.end()) {
+        erase(it);
+    }
+    it = after(node);
+    if (it != ranges_.end() && it->second.lower == node) {
+        erase(it);
+    }
+}
+
+void LookupCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ranges_.clear();
+    lru_.clear();
+}
+
+LookupCache::Ranges::iterator LookupCache::containing(const NodeId& id) {
+    if (ranges_.empty()) {
+        return ranges_.end();
+    }
+    auto it = ranges_.lower_bound(id);
+    if (it == ranges_.end()) {
+        it = ranges_.begin();
+    }
+    return within(id.data(), it->second.lower.data(), it->first.data()) ? it : ranges_.end();
+}
+
+LookupCache::Ranges::iterator LookupCache::after(const NodeId& id) {
+    if (ranges_.empty()) {
+        return ranges_.end();
+    }
+    auto it = ranges_.upper_bound(id);
+    return it == ranges_.end() ? ranges_.begin() : it;
+}
+
+void LookupCache::erase(Ranges::iterator it) {
+    lru_.erase(it->second.lru);
+    ranges_.erase(it);
+}
+
+}  // namespace chord
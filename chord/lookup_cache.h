@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+
+#include "common/node_ref.h"
+
+namespace chord {
+
+/*! \brief ranges cached by a node, and for how long a cached owner is trusted. */
+const size_t kLookupCacheSize   = 1024;
+const int32_t kLookupCacheTtlMs = 10000;
+
+/**
+ * \brief  owners of recently looked up ranges of the ring. A lookup that
+ *         resolves id learns that owner is responsible for (pred, owner],
+ *         so any later id in that range is answered without a network hop.
+ *         The ranges are disjoint and kept in a map by owner id, so the range
+ *         of an id is the first one ending at or after it; at most capacity
+ *         ranges are kept, least recently used ones go first, and a range
+ *         expires ttl after it was learned.
+ * \note   thread-safe.
+ */
+class LookupCache {
+   public:
+    typedef std::chrono::steady_clock Clock;
+
+    LookupCache(size_t capacity, int32_t ttl_ms) : capacity_(capacity), ttl_(std::chrono::milliseconds(ttl_ms)) {}
+
+    /*! \brief sets owner to the cached owner of id, and counts a hit or a miss. */
+    bool find(const NodeId& id, NodeRef* owner);
+
+    /*! \brief owner owns (pred, owner], overlapping ranges are dropped. */
+    void insert(const NodeRef& pred, const NodeRef& owner);
+
+    /**
+     * \brief  drops the ranges a membership change of node makes stale: the
+     *         one holding node, which it splits or owned, and the one after it.
+     */
+    void invalidate(const NodeId& node);
+
+    void clear();
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+   private:
+    struct Entry
+    {
+        NodeId lower;
+        NodeRef owner;
+        Clock::time_point expires;
+        std::list<NodeId>::iterator lru;
+    };
+    typedef std::map<NodeId, Entry> Ranges;
+
+    /*! \brief the range holding id, or end. */
+    Ranges::iterator containing(const NodeId& id);
+
+    /*! \brief the first range ending after id, wrapping around, or end if there is none. */
+    Ranges::iterator after(const NodeId& id);
+
+    void erase(Ranges::iterator it);
+
+    std::mutex mutex_;
+    size_t capacity_;
+    Clock::duration ttl_;
+    Ranges ranges_;
+    // owner ids, most recently used first
+    std::list<NodeId> lru_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace chord
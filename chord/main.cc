@@ -1,24 +1,55 @@
+#include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
 #include "chord.h"
-#include "common/async_timer_queue.h"
+#include "common/connection_pool.h"
 #include "common/cxxopts.h"
+#include "common/timer_wheel.h"
 #include "node.h"
 
+/**
+ * \brief  reads the period of a maintenance task from flag, either a fixed
+ *         period in milliseconds or min:max, a period that backs off towards
+ *         max while the ring is stable and drops to min on churn.
+ */
+void init_interval(const cxxopts::ParseResult& result, const std::string& flag, const std::string& task,
+                   chord::AdaptiveInterval* interval) {
+    std::string value = result[flag].as<std::string>();
+    size_t colon      = value.find(':');
+    char* end         = nullptr;
+    long min          = strtol(value.c_str(), &end, 10);
+    long max          = min;
+    CHECK(end == value.c_str() + std::min(colon, value.size()) && end != value.c_str())
+        << "Invalid option for the time in milliseconds between invocations of '" << task << "': " << value;
+    if (colon != std::string::npos) {
+        const char* begin = value.c_str() + colon + 1;
+        max               = strtol(begin, &end, 10);
+        CHECK(*end == '\0' && end != begin)
+            << "Invalid option for the time in milliseconds between invocations of '" << task << "': " << value;
+    }
+    CHECK_GE(min, 1) << "The time in milliseconds between invocations of '" << task
+                     << "' must be greater than or equal to 1";
+    CHECK_LE(max, 60000) << "The time in milliseconds between invocations of '" << task
+                         << "' must be less than or equal to 60000";
+    CHECK_LE(min, max) << "The shortest time between invocations of '" << task << "' must not exceed the longest";
+    interval->setBounds(min, max);
+}
+
 void init_node(const cxxopts::ParseResult& result, chord::Node* node) {
     // address
-    CHECK_GE(inet_pton(AF_INET, result["a"].as<std::string>().c_str(), &node->address.sin_addr.s_addr), 1)
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    CHECK_GE(inet_pton(AF_INET, result["a"].as<std::string>().c_str(), &address.sin_addr.s_addr), 1)
         << "Invalid IPv4 address";
-    node->address.sin_family = AF_INET;
-    node->addr               = result["a"].as<std::string>();
+    address.sin_family = AF_INET;
 
     // port
     if (result.count("p")) {
         int16_t port = result["p"].as<int16_t>();
         CHECK_GE(port, 1024) << "Invalid option for a port, must be greater than or equal to 1024";
         CHECK_LE(port, 65535) << "Invalid option for a port, must be less than or equal to 65535";
-        node->address.sin_port = htons(port);
-        node->port             = result["p"].as<std::int16_t>();
+        address.sin_port = htons(port);
     }
 
     // join address
@@ -34,28 +65,10 @@ void init_node(const cxxopts::ParseResult& result, chord::Node* node) {
         node->join_address.sin_port = htons(port);
     }
 
-    // stabilize time
-    int32_t ts = result["ts"].as<int32_t>();
-    CHECK_GE(ts, 1) << "The time in milliseconds between invocations of 'stabilize' must be greater than or equal to 1";
-    CHECK_LE(ts, 60000)
-        << "The time in milliseconds between invocations of 'stabilize' must be less than or equal to 60000";
-    node->tv_stabilize = ts;
-
-    // fix fingers time
-    int32_t tff = result["tff"].as<int32_t>();
-    CHECK_GE(tff, 1)
-        << "The time in milliseconds between invocations of 'fix fingers' must be greater than or equal to 1";
-    CHECK_LE(tff, 60000)
-        << "The time in milliseconds between invocations of 'fix fingers' must be less than or equal to 60000";
-    node->tv_fix_fingers = tff;
-
-    // check predecessor time
-    int32_t tcp = result["tcp"].as<int32_t>();
-    CHECK_GE(tcp, 1)
-        << "The time in milliseconds between invocations of 'check predecessor' must be greater than or equal to 1";
-    CHECK_LE(tcp, 60000)
-        << "The time in milliseconds between invocations of 'check predecessor' must be less than or equal to 60000";
-    node->tv_check_predecessor = tcp;
+    // stabilize, fix fingers and check predecessor times
+    init_interval(result, "ts", "stabilize", &node->tv_stabilize);
+    init_interval(result, "tff", "fix fingers", &node->tv_fix_fingers);
+    init_interval(result, "tcp", "check predecessor", &node->tv_check_predecessor);
 
     // # successors
     int32_t r = result["r"].as<int32_t>();
@@ -63,9 +76,22 @@ void init_node(const cxxopts::ParseResult& result, chord::Node* node) {
     CHECK_LE(r, 32) << "The number of successors maintained must be must be less than or equal to 32";
     node->r = r;
 
+    // lookup mode
+    std::string mode = result["lookup"].as<std::string>();
+    CHECK(mode == "recursive" || mode == "iterative") << "The lookup mode must be either 'recursive' or 'iterative'";
+    node->iterative = mode == "iterative";
+
+    // # parallel queries of an iterative lookup
+    int32_t alpha = result["alpha"].as<int32_t>();
+    CHECK_GE(alpha, 1) << "The number of parallel lookup queries must be greater than or equal to 1";
+    CHECK_LE(alpha, 16) << "The number of parallel lookup queries must be less than or equal to 16";
+    node->alpha = alpha;
+
     // id = hash(ip:port)
+    chord::NodeId id;
     std::string ip_port = result["a"].as<std::string>() + ":" + std::to_string(result["p"].as<int16_t>());
-    SHA1((const uint8_t*)ip_port.c_str(), ip_port.size(), node->id);
+    SHA1((const uint8_t*)ip_port.c_str(), ip_port.size(), id.data());
+    node->self = chord::NodeRef(id, address);
 }
 
 int main(int argc, char* argv[]) {
@@ -77,10 +103,12 @@ int main(int argc, char* argv[]) {
         ("p,port",  "The port to bind to (required)", cxxopts::value<int16_t>())
         ("ja",      "The IPv4 address of a node whose ring to join", cxxopts::value<std::string>()->default_value("127.0.0.1"))
         ("jp",      "The port of a node whose ring to join (required)", cxxopts::value<int16_t>())
-        ("ts",      "The time in milliseconds between invocations of 'stabilize'", cxxopts::value<int32_t>()->default_value("30000"))
-        ("tff",     "The time in milliseconds between invocations of 'fix fingers'", cxxopts::value<int32_t>()->default_value("1000"))
-        ("tcp",     "The time in milliseconds between invocations of 'check predecessor'", cxxopts::value<int32_t>()->default_value("30000"))
+        ("ts",      "The time in milliseconds between invocations of 'stabilize', or min:max to adapt it to churn", cxxopts::value<std::string>()->default_value("1000:30000"))
+        ("tff",     "The time in milliseconds between invocations of 'fix fingers', or min:max to adapt it to churn", cxxopts::value<std::string>()->default_value("100:10000"))
+        ("tcp",     "The time in milliseconds between invocations of 'check predecessor', or min:max to adapt it to churn", cxxopts::value<std::string>()->default_value("1000:30000"))
         ("r",       "The number of successors to maintain", cxxopts::value<int32_t>()->default_value("3"))
+        ("lookup",  "The lookup mode, 'recursive' or 'iterative'", cxxopts::value<std::string>()->default_value("recursive"))
+        ("alpha",   "The number of parallel queries of an iterative lookup", cxxopts::value<int32_t>()->default_value("3"))
         ("h,help",  "Print help")
         ("v",       "Enable verbose");
     // clang-format on
@@ -110,10 +138,34 @@ int main(int argc, char* argv[]) {
     }
 
     // called periodically
-    std::thread asyncthread(&chord::AsyncTimerQueue::timerLoop, &chord::AsyncTimerQueue::Instance());
-    chord::AsyncTimerQueue::Instance().create(node->tv_fix_fingers, true, &chord::Node::fixFingers, node);
-    chord::AsyncTimerQueue::Instance().create(node->tv_check_predecessor, true, &chord::Node::checkPredecessor, node);
-    chord::AsyncTimerQueue::Instance().create(node->tv_stabilize, true, &chord::Node::stabilize, node);
+    std::thread asyncthread(&chord::TimerWheel::timerLoop, &chord::TimerWheel::Instance());
+    auto adapt = [](chord::AdaptiveInterval* interval, int id) {
+        interval->setListener([id](int32_t interval_ms) { chord::TimerWheel::Instance().setInterval(id, interval_ms); });
+    };
+#ifdef CHORD_WITH_COROUTINES
+    // a round waiting for replies is a suspended coroutine, not a blocked
+    // thread, and its timer skips turns until the round is done
+    auto round = [node](chord::Task<void> (chord::Node::*f)()) {
+        return [node, f](std::function<void()> done) { chord::spawn((node->*f)(), std::move(done)); };
+    };
+    adapt(&node->tv_fix_fingers, chord::TimerWheel::Instance().createAsync(
+                                     "fixFingers", node->tv_fix_fingers.current(), true, round(&chord::Node::fixFingersCo)));
+    adapt(&node->tv_check_predecessor,
+          chord::TimerWheel::Instance().createAsync("checkPredecessor", node->tv_check_predecessor.current(), true,
+                                                    round(&chord::Node::checkPredecessorCo)));
+    adapt(&node->tv_stabilize, chord::TimerWheel::Instance().createAsync(
+                                   "stabilize", node->tv_stabilize.current(), true, round(&chord::Node::stabilizeCo)));
+#else
+    adapt(&node->tv_fix_fingers, chord::TimerWheel::Instance().create("fixFingers", node->tv_fix_fingers.current(),
+                                                                      true, &chord::Node::fixFingers, node));
+    adapt(&node->tv_check_predecessor,
+          chord::TimerWheel::Instance().create("checkPredecessor", node->tv_check_predecessor.current(), true,
+                                               &chord::Node::checkPredecessor, node));
+    adapt(&node->tv_stabilize, chord::TimerWheel::Instance().create("stabilize", node->tv_stabilize.current(), true,
+                                                                    &chord::Node::stabilize, node));
+#endif
+    chord::TimerWheel::Instance().create("evictIdle", chord::kIdleTimeoutMs, true, &chord::ConnectionPool::evictIdle,
+                                         &chord::ConnectionPool::Instance());
 
     // bind and listen to socket (non-blocking)
     node->rpc_server();
@@ -133,6 +185,9 @@ int main(int argc, char* argv[]) {
             node->lookup(key);
         } else if (cmd == "PrintState") {
             node->dump();
+        } else if (cmd == "Stats") {
+            node->stats();
+            chord::TimerWheel::Instance().report(std::cout);
         }
     }
 
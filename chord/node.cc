@@ -1,16 +1,123 @@
 #include "node.h"
 #include "common/bigint.h"
+#include "common/connection_pool.h"
 #include "common/net-buffer.h"
 #include "common/socket-util.h"
+#include "common/timer_wheel.h"
+#include "common/vivaldi.h"
 #include "rpc.h"
 
+#include <condition_variable>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <thread>
 
 namespace chord {
 
+/*! \brief fingers refreshed per fixFingers() round, resolved with a single batch. */
+const size_t kFingersPerFix = 16;
+
+/*! \brief the closest preceding nodes a next hop is chosen from by predicted RTT. */
+const size_t kProximityCandidates = 4;
+
+namespace {
+
+/*! \brief whether a and b list the same nodes in the same order. */
+bool same_nodes(const std::vector<NodeRef>& a, const std::vector<NodeRef>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].id != b[i].id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*! \brief the number of significant bits of the distance from a to b on the ring. */
+int distance_bits(const NodeId& a, const NodeId& b) {
+    NodeId d = b;
+    sub(a.data(), d.data());
+    for (int i = 0; i < SHA_DIGEST_LENGTH; ++i) {
+        if (d.bytes[i] != 0) {
+            return (SHA_DIGEST_LENGTH - 1 - i) * 8 + (32 - __builtin_clz(d.bytes[i]));
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief  replies to the queries of one iterative lookup. The callbacks of
+ *         the queries share it, so a straggler can still report after the
+ *         lookup went on with a faster answer.
+ */
+struct IterativeLookup
+{
+    struct Reply
+    {
+        NodeRef from;
+        bool ok;
+        // the query failed on a pooled channel the peer had closed
+        bool broken;
+        protocol::FindNextHopRet hop;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Reply> replies;
+};
+
+/*! \brief a query of an iterative lookup waiting for its reply. */
+struct NextHopQuery
+{
+    std::shared_ptr<Channel> channel;
+    uint64_t call;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+/**
+ * \brief  asks target for the next hop towards id, the reply lands in state.
+ *         retried is set when the query is sent again on a fresh channel.
+ * \return false if target cannot be reached.
+ */
+bool query_next_hop(const std::shared_ptr<IterativeLookup>& state, const NodeRef& target, const NodeId& id,
+                    uint32_t count, bool retried, NextHopQuery* query) {
+    bool reused    = false;
+    query->channel = ConnectionPool::Instance().acquire(target.address, &reused);
+    if (query->channel == nullptr) {
+        return false;
+    }
+    query->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kCallTimeoutMs);
+
+    bool stale   = reused && !retried;
+    Channel* raw = query->channel.get();
+    query->call  = rpc_send_find_next_hop_async(raw, id, count, [state, target, raw, stale](bool ok,
+                                                                                         protocol::FindNextHopRet* hop) {
+        IterativeLookup::Reply reply;
+        reply.from = target;
+        reply.ok   = ok;
+        // a peer may have closed an idle pooled channel, that is worth one more try
+        reply.broken = !ok && stale && raw->broken();
+        if (ok) {
+            reply.hop.Swap(hop);
+        }
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->replies.push_back(std::move(reply));
+        }
+        state->cv.notify_one();
+    });
+    return true;
+}
+
+}  // namespace
+
 inline std::string hash2string(const uint8_t* hash, uint16_t size) {
     std::stringstream buffer;
     for (int i = 0; i < size; i++) {
@@ -19,204 +126,993 @@ inline std::string hash2string(const uint8_t* hash, uint16_t size) {
     return buffer.str();
 }
 
-Node::Node() { id = new uint8_t[SHA_DIGEST_LENGTH]; }
-
-Node::Node(const protocol::Node& node) {
-    id = new uint8_t[SHA_DIGEST_LENGTH];
-    memcpy(id, node.id().c_str(), SHA_DIGEST_LENGTH);
-    addr = node.address();
-    CHECK_GE(inet_pton(AF_INET, addr.c_str(), &address.sin_addr.s_addr), 1) << "Invalid IPv4 address";
-    address.sin_family = AF_INET;
-    port               = node.port();
-    address.sin_port   = htons(port);
+Node::Node() : parallel_batches(true), cache(kLookupCacheSize, kLookupCacheTtlMs), next_finger(0) {
+    // a node that created the ring joined through no one
+    memset(&join_address, 0, sizeof(join_address));
 }
 
+NodeRef Node::getSuccessor() { return routing.read()->successor; }
+
+NodeRef Node::getPredecessor() { return routing.read()->predecessor; }
+
+std::vector<NodeRef> Node::getSuccessorList() { return routing.read()->succ_list; }
+
 void Node::create() {
-    predecessor = nullptr;
-    successor   = new protocol::Node();
-    successor->set_address(this->getAddr());
-    successor->set_port(this->getPort());
-    successor->set_id(this->getId(), SHA_DIGEST_LENGTH);
+    routing.update([this](RoutingState& state) {
+        state.predecessor = NodeRef();
+        state.successor   = self;
+        state.succ_list.assign(1, self);
+        state.fingers.reset(self);
+        return true;
+    });
 }
 
 void Node::join() {
-    predecessor = nullptr;
-
-    int32_t peer_sockfd;
-    CHECK_GE(peer_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), 0) << "Failed to create socket";
-
-    if (connect(peer_sockfd, (struct sockaddr*)&join_address, sizeof(join_address)) < 0) {
-        close(peer_sockfd);
-        LOG(FATAL) << "Failed to connect to server";
-    }
+    NodeRef succ;
+    bool joined = ConnectionPool::Instance().call(
+        join_address, [this, &succ](Channel* channel) { return rpc_send_find_successor(channel, self.id, &succ, nullptr); });
+    CHECK_EQ(joined, true) << "Failed to join a Chord ring";
 
-    CHECK_EQ(rpc_send_find_successor(peer_sockfd, this), true) << "Failed to join a Chord ring";
-    close(peer_sockfd);
+    routing.update([this, &succ](RoutingState& state) {
+        state.predecessor = NodeRef();
+        state.successor   = succ;
+        state.succ_list.assign(1, succ);
+        state.fingers.reset(self);
+        return true;
+    });
 }
 
 void Node::lookup(std::string key) {
     // key and its hash value
-    uint8_t hash[SHA_DIGEST_LENGTH];
-    SHA1((const uint8_t*)key.c_str(), key.size(), hash);
+    NodeId hash;
+    SHA1((const uint8_t*)key.c_str(), key.size(), hash.data());
     std::cout << "< " + key + " ";
-    std::cout << hash2string(hash, SHA_DIGEST_LENGTH);
+    std::cout << hash2string(hash.data(), SHA_DIGEST_LENGTH);
     puts("");
 
     // The successor client's node information
-    Node* succ = this->findSuccessor(hash);
+    NodeRef succ;
+    if (!cache.find(hash, &succ)) {
+        NodeRef pred;
+        succ = iterative ? this->findSuccessorIterative(hash, &pred) : this->findSuccessor(hash, &pred);
+        cache.insert(pred, succ);
+    }
     std::cout << "< ";
-    std::cout << hash2string(succ->getId(), SHA_DIGEST_LENGTH);
-    std::cout << " " + succ->getAddr() + " " + std::to_string(succ->getPort());
+    std::cout << hash2string(succ.id.data(), SHA_DIGEST_LENGTH);
+    std::cout << " " + succ.addr() + " " + std::to_string(succ.port);
     puts("");
 }
 
+std::shared_ptr<PendingLookup> Node::lookupAsync(const std::string& key, LookupCallback done, int32_t timeout_ms) {
+    NodeId hash;
+    SHA1((const uint8_t*)key.c_str(), key.size(), hash.data());
+
+    auto deadline = PendingLookup::Clock::now() + std::chrono::milliseconds(timeout_ms);
+    auto lookup   = std::make_shared<PendingLookup>(hash, std::move(done), deadline);
+    NodeRef owner;
+    if (cache.find(hash, &owner)) {
+        lookup->complete(LookupResult{LookupStatus::kOk, owner});
+        return lookup;
+    }
+    LookupLoop::Instance().expire(lookup);
+    LookupLoop::Instance().post([this, lookup] { lookupStep(lookup); });
+    return lookup;
+}
+
+std::future<LookupResult> Node::lookupAsync(const std::string& key, int32_t timeout_ms,
+                                            std::shared_ptr<PendingLookup>* handle) {
+    auto promise                     = std::make_shared<std::promise<LookupResult>>();
+    std::future<LookupResult> future = promise->get_future();
+    auto lookup = lookupAsync(key, [promise](const LookupResult& result) { promise->set_value(result); }, timeout_ms);
+    if (handle != nullptr) {
+        *handle = lookup;
+    }
+    return future;
+}
+
+void Node::lookupStep(const std::shared_ptr<PendingLookup>& lookup, bool retried) {
+    // the same walk as findSuccessor, one hop per step, every failed hop is evicted or waited for
+    if (lookup->finished()) {
+        return;
+    }
+    const NodeId& id = lookup->id();
+    NodeRef succ     = getSuccessor();
+    NodeRef node     = closetPrecedingNode(id);
+    if (within(id.data(), this->getId(), succ.id.data()) || node.id == self.id) {
+        lookup->complete(LookupResult{LookupStatus::kOk, succ});
+        return;
+    }
+
+    // the lookup thread must not sleep, the step is taken again once the backoff is over
+    int32_t busy = ConnectionPool::Instance().busyFor(node.address);
+    if (busy > 0) {
+        TimerWheel::Instance().create("lookupBackoff", busy, false, [this, lookup] {
+            LookupLoop::Instance().post([this, lookup] { lookupStep(lookup); });
+        });
+        return;
+    }
+
+    // connecting may block for as long as the peer takes to answer, so it
+    // happens off the lookup thread and the step goes on from there
+    std::shared_ptr<Channel> channel = ConnectionPool::Instance().find(node.address);
+    if (channel != nullptr) {
+        lookupHop(lookup, node, channel, true, retried);
+        return;
+    }
+    LookupLoop::Instance().connect(node.address, [this, lookup, node, retried](const std::shared_ptr<Channel>& channel,
+                                                                               bool reused) {
+        if (lookup->finished()) {
+            return;
+        }
+        if (channel == nullptr) {
+            LOG(WARNING) << "Next hop " << node.addr() << ":" << node.port << " has failed";
+            evict(node);
+            lookupStep(lookup);
+            return;
+        }
+        lookupHop(lookup, node, channel, reused, retried);
+    });
+}
+
+void Node::lookupHop(const std::shared_ptr<PendingLookup>& lookup, const NodeRef& node,
+                     const std::shared_ptr<Channel>& channel, bool reused, bool retried) {
+    // the reply arrives on the reader thread of the channel, the next step
+    // runs on the lookup thread instead
+    bool stale    = reused && !retried;
+    Channel* raw  = channel.get();
+    uint64_t call = rpc_send_find_successor_async(
+        raw, lookup->id(), [this, lookup, node, raw, stale](bool ok, const NodeRef& found, const NodeRef& pred) {
+            // a peer may have closed an idle pooled channel, that is worth one more try
+            bool broken = !ok && stale && raw->broken();
+            LookupLoop::Instance().post([this, lookup, node, ok, broken, found, pred] {
+                if (ok) {
+                    cache.insert(pred, found);
+                    lookup->complete(LookupResult{LookupStatus::kOk, found});
+                    return;
+                }
+                if (lookup->finished()) {
+                    return;
+                }
+                if (broken) {
+                    ConnectionPool::Instance().invalidate(node.address);
+                    lookupStep(lookup, true);
+                    return;
+                }
+                hopFailed(node);
+                lookupStep(lookup);
+            });
+        });
+    lookup->inflight(channel, call);
+}
+
 void Node::dump() {
+    // a copy, so that writers do not wait for the output
+    RoutingState state = *routing.read();
+
     // The Chord client's own node information
     std::cout << "< Self " << hash2string(this->getId(), SHA_DIGEST_LENGTH);
     std::cout << " " + this->getAddr() + " " + std::to_string(this->getPort());
     puts("");
 
     // The node information for all nodes in the successor list
-    std::cout << "< Successor [1] " << hash2string((const uint8_t*)this->successor->id().c_str(), SHA_DIGEST_LENGTH);
-    std::cout << " " + this->successor->address() + " " + std::to_string(this->successor->port());
-    puts("");
+    for (size_t i = 0; i < state.succ_list.size(); ++i) {
+        const NodeRef& succ = state.succ_list[i];
+        std::cout << "< Successor [" << i + 1 << "] " << hash2string(succ.id.data(), SHA_DIGEST_LENGTH);
+        std::cout << " " + succ.addr() + " " + std::to_string(succ.port);
+        puts("");
+    }
 
     // The node information for all nodes in the finger table
-    for (int i = 0; i < finger_table.size(); ++i) {
-        std::cout << "< Finger [" << i + 1 << "] " << hash2string(finger_table[i]->getId(), SHA_DIGEST_LENGTH);
-        std::cout << " " + finger_table[i]->getAddr() + " " + std::to_string(finger_table[i]->getPort());
+    for (size_t i = 0; i < kFingers; ++i) {
+        const NodeRef& finger = state.fingers.finger(i);
+        std::cout << "< Finger [" << i + 1 << "] " << hash2string(finger.id.data(), SHA_DIGEST_LENGTH);
+        std::cout << " " + finger.addr() + " " + std::to_string(finger.port);
         puts("");
     }
 }
 
+void Node::stats() {
+    std::cout << "< Lookup cache " << cache.hits() << " hits " << cache.misses() << " misses";
+    puts("");
+    std::cout << "< Intervals stabilize " << tv_stabilize.current() << " ms fix fingers " << tv_fix_fingers.current()
+              << " ms check predecessor " << tv_check_predecessor.current() << " ms";
+    puts("");
+    ServerStats& server = server_stats();
+    std::cout << "< Server queue " << server.queued << " max " << server.max_queued << " served " << server.served
+              << " maintenance " << server.maintenance << " shed " << server.shed;
+    puts("");
+}
+
+void Node::churn() {
+    tv_stabilize.churn();
+    tv_fix_fingers.churn();
+    tv_check_predecessor.churn();
+}
+
 void Node::rpc_server() {
     int opt       = 1;
     server_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     CHECK_GE(server_sockfd, 0) << "Failed to open socket";
     CHECK_GE(setsockopt(server_sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)), 0);
-    CHECK_GE(bind(server_sockfd, (struct sockaddr*)&address, sizeof(address)), 0) << "Failed to bind to port";
+    CHECK_GE(bind(server_sockfd, (struct sockaddr*)&self.address, sizeof(self.address)), 0) << "Failed to bind to port";
     CHECK_GE(listen(server_sockfd, MAX_TCP_CONNECTIONS), 0) << "Listen failed";
-    // CHECK_GE(fcntl(server_sockfd, F_SETFL, fcntl(server_sockfd, F_GETFL, 0) | O_NONBLOCK), 0)
-    //     << "Failed to set listen socket to non-blocking";
+    CHECK_GE(fcntl(server_sockfd, F_SETFL, fcntl(server_sockfd, F_GETFL, 0) | O_NONBLOCK), 0)
+        << "Failed to set listen socket to non-blocking";
     std::thread thx(rpc_daemon, server_sockfd, this);
     thx.detach();
 }
 
 void Node::notify() {
-    int32_t peer_sockfd;
-    CHECK_GE(peer_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), 0) << "Failed to create socket";
+    NodeRef succ = getSuccessor();
 
-    chord::Node* n = new chord::Node(*successor);
-
-    if (connect(peer_sockfd, (struct sockaddr*)&n->address, sizeof(n->address)) < 0) {
-        close(peer_sockfd);
-        LOG(FATAL) << "Failed to connect to server";
+    // tells the successor where this node is, too
+    NodeRef me    = self;
+    me.coord      = Vivaldi::Instance().local();
+    bool notified = ConnectionPool::Instance().call(
+        succ.address, [&me](Channel* channel) { return rpc_send_notify(channel, me); });
+    if (!notified) {
+        // the next stabilize finds out whether it failed
+        LOG(WARNING) << "Failed to notify successor";
     }
+}
 
-    CHECK_EQ(rpc_send_notify(peer_sockfd, this), true) << "Failed to join a get predecessor";
-    close(peer_sockfd);
+bool get_predecessor(const NodeRef& node, NodeRef* pred) {
+    return ConnectionPool::Instance().call(
+        node.address, [pred](Channel* channel) { return rpc_send_get_predecessor(channel, pred); });
 }
 
-protocol::Node* get_predecessor(const protocol::Node& node) {
-    int32_t peer_sockfd;
-    CHECK_GE(peer_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), 0) << "Failed to create socket";
+bool get_successor_list(const NodeRef& node, const NodeId& self, std::vector<NodeRef>* succs) {
+    return ConnectionPool::Instance().call(
+        node.address, [&self, succs](Channel* channel) { return rpc_send_get_successor_list(channel, self, succs); });
+}
 
-    chord::Node* n = new chord::Node(node);
+void Node::stabilize() {
+    LOG(INFO) << "[stabilize] called periodically.";
 
-    if (connect(peer_sockfd, (struct sockaddr*)&n->address, sizeof(n->address)) < 0) {
-        close(peer_sockfd);
-        LOG(FATAL) << "Failed to connect to server";
+    // the first successor that answers, failed ones are dropped on the way
+    NodeRef succ = getSuccessor();
+    NodeRef pred;
+    while (!get_predecessor(succ, &pred)) {
+        LOG(WARNING) << "Successor " << succ.addr() << ":" << succ.port << " has failed";
+        if (succ.id == self.id) {
+            return;
+        }
+        evict(succ);
+        succ = getSuccessor();
     }
 
-    CHECK_EQ(rpc_send_get_predecessor(peer_sockfd, n), true) << "Failed to join a get predecessor";
-    close(peer_sockfd);
+    // every node this one knew failed, as when the successor it joined at
+    // fails before it heard of any other, so it asks its way back in
+    if (succ.id == self.id && join_address.sin_port != 0) {
+        NodeRef found;
+        bool rejoined = ConnectionPool::Instance().call(join_address, [this, &found](Channel* channel) {
+            return rpc_send_find_successor(channel, self.id, &found, nullptr);
+        });
+        if (rejoined && found.id != self.id) {
+            setSuccessor(found, std::vector<NodeRef>());
+            churn();
+            return;
+        }
+    }
+
+    std::vector<NodeRef> succs;
+    if (pred.valid() && within(pred.id.data(), this->getId(), succ.id.data()) &&
+        get_successor_list(pred, self.id, &succs)) {
+        succ = pred;
+    } else if (!get_successor_list(succ, self.id, &succs)) {
+        LOG(WARNING) << "Failed to get the successor list";
+        churn();
+        return;
+    }
 
-    return n->predecessor;
+    bool changed = setSuccessor(succ, succs);
+    notify();
+    if (changed) {
+        churn();
+    } else {
+        tv_stabilize.stable();
+    }
 }
 
-void Node::stabilize() {
-    LOG(INFO) << "[stabilize] called periodically.";
-    auto pred = get_predecessor(*successor);
-    if (pred != nullptr &&
-        within((const uint8_t*)pred->id().c_str(), this->getId(), (const uint8_t*)successor->id().c_str())) {
-        successor = pred;
+bool Node::setSuccessor(const NodeRef& succ, const std::vector<NodeRef>& succs) {
+    std::vector<NodeRef> list(1, succ);
+    for (size_t i = 0; i < succs.size() && list.size() < (size_t)r; ++i) {
+        list.push_back(succs[i]);
     }
-    notify();
+    NodeRef old;
+    bool same = false;
+    routing.update([&succ, &list, &old, &same](RoutingState& state) {
+        // the nodes may be the same with fresher coordinates, so always publish
+        old             = state.successor;
+        same            = same_nodes(state.succ_list, list);
+        state.successor = succ;
+        state.succ_list.swap(list);
+        return true;
+    });
+    if (old.id != succ.id) {
+        // a node joined between us and the old successor
+        cache.invalidate(succ.id);
+    }
+    return !same || old.id != succ.id;
 }
 
 void Node::initFingers() {
-    for (int i = 1; i <= SHA_DIGEST_LENGTH * 8; ++i) {
-        uint8_t t[SHA_DIGEST_LENGTH];
-        pow2((i - 1), t);
-        add(this->id, t);
-        finger_table.push_back(findSuccessor(t));
+    std::vector<NodeId> targets;
+    {
+        auto state = routing.read();
+        for (size_t i = 0; i < kFingers; ++i) {
+            targets.push_back(state->fingers.start(i));
+        }
     }
+    auto succs = findSuccessorBatch(targets);
+
+    routing.update([&succs](RoutingState& state) {
+        for (size_t i = 0; i < kFingers; ++i) {
+            state.fingers.set(i, succs[i]);
+        }
+        return true;
+    });
 }
 
 void Node::fixFingers() {
     LOG(INFO) << "[fix fingers] called periodically.";
-    static size_t next;
-    next = next + 1;
-    if (next > SHA_DIGEST_LENGTH * 8) {
-        next = 1;
+    std::vector<size_t> index;
+    std::vector<NodeId> targets;
+    nextFingers(&index, &targets);
+
+    auto succs = findSuccessorBatch(targets);
+
+    // any node in the interval of a finger makes a correct finger, so the
+    // nodes right after the exact successor are candidates too
+    Coordinate local = Vivaldi::Instance().local();
+    std::map<NodeId, std::vector<NodeRef>> after;
+    if (local.known()) {
+        for (auto& s : succs) {
+            if (s.id != self.id && after.count(s.id) == 0 && !get_successor_list(s, self.id, &after[s.id])) {
+                after[s.id].clear();
+            }
+        }
+    }
+    if (setFingers(index, succs, local, after)) {
+        churn();
+    } else {
+        tv_fix_fingers.stable();
+    }
+}
+
+void Node::nextFingers(std::vector<size_t>* index, std::vector<NodeId>* targets) {
+    auto state = routing.read();
+    for (size_t k = 0; k < kFingersPerFix; ++k) {
+        next_finger = next_finger + 1;
+        if (next_finger > kFingers) {
+            next_finger = 1;
+        }
+        targets->push_back(state->fingers.start(next_finger - 1));
+        index->push_back(next_finger - 1);
     }
+}
 
-    uint8_t t[SHA_DIGEST_LENGTH];
-    pow2((next - 1), t);
-    add(this->id, t);
-    finger_table[next] = findSuccessor(t);
+bool Node::setFingers(const std::vector<size_t>& index, const std::vector<NodeRef>& succs, const Coordinate& local,
+                      const std::map<NodeId, std::vector<NodeRef>>& after) {
+    bool changed = false;
+    routing.update([this, &succs, &index, &local, &after, &changed](RoutingState& state) {
+        for (size_t k = 0; k < succs.size(); ++k) {
+            // the nearest candidate, one without a coordinate never wins
+            NodeRef best = succs[k];
+            auto it      = after.find(best.id);
+            for (size_t c = 0; it != after.end() && c < it->second.size(); ++c) {
+                const NodeRef& node = it->second[c];
+                if (node.id == self.id || !node.coord.known() || !state.fingers.inInterval(index[k], node.id)) {
+                    continue;
+                }
+                if (!best.coord.known() || local.rtt(node.coord) < local.rtt(best.coord)) {
+                    best = node;
+                }
+            }
+            changed = changed || state.fingers.finger(index[k]).id != best.id;
+            state.fingers.set(index[k], best);
+        }
+        return true;
+    });
+    return changed;
 }
 
 void Node::checkPredecessor() {
     LOG(INFO) << "[checkPredecessor] called periodically.";
-    if (predecessor != nullptr && predecessor->has_id()) {
-        int32_t pred_sockfd;
-        CHECK_GE(pred_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), 0) << "Failed to create socket";
-        auto pred = new chord::Node(*predecessor);
-
-        if (connect(pred_sockfd, (struct sockaddr*)&(pred->address), sizeof(pred->address)) == 0) {
-            rpc_send_check_predecessor(pred_sockfd);
-            close(pred_sockfd);
-        } else {
-            LOG(WARNING) << "Predecessor has failed";
-            predecessor = nullptr;
+    NodeRef pred = getPredecessor();
+    if (pred.valid()) {
+        // a pooled socket only proves the peer was alive, so ask it
+        if (!ConnectionPool::Instance().call(pred.address, rpc_send_check_predecessor)) {
+            predecessorFailed(pred);
+            return;
+        }
+    }
+    tv_check_predecessor.stable();
+}
+
+void Node::predecessorFailed(const NodeRef& pred) {
+    LOG(WARNING) << "Predecessor has failed";
+    ConnectionPool::Instance().invalidate(pred.address);
+
+    routing.update([&pred](RoutingState& state) {
+        if (state.predecessor.id != pred.id) {
+            return false;
+        }
+        state.predecessor = NodeRef();
+        return true;
+    });
+    churn();
+}
+
+NodeRef Node::findSuccessor(const NodeId& id, NodeRef* pred) {
+    // every failed hop is evicted, and one that shed the call is waited for
+    // once and then routed around, so this ends once we run out of nodes
+    std::set<NodeId> shed;
+    while (1) {
+        NodeRef succ = getSuccessor();
+        if (within(id.data(), this->getId(), succ.id.data())) {
+            if (pred != nullptr) {
+                *pred = self;
+            }
+            return succ;
+        }
+        NodeRef node = closetPrecedingNode(id, shed);
+        if (node.id == self.id) {
+            // no finger precedes id, forwarding to ourselves would never end
+            return succ;
+        }
+
+        // a busy node is only chosen when no other one makes progress, then we wait for it
+        int32_t busy = ConnectionPool::Instance().busyFor(node.address);
+        if (busy > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(busy));
+        }
+
+        NodeRef found;
+        bool ok = ConnectionPool::Instance().call(node.address, [&id, &found, pred](Channel* channel) {
+            return rpc_send_find_successor(channel, id, &found, pred);
+        });
+        if (ok) {
+            return found;
+        }
+        if (ConnectionPool::Instance().shedding(node.address)) {
+            shed.insert(node.id);
+        }
+        hopFailed(node);
+    }
+}
+
+std::vector<NodeRef> Node::findSuccessorBatch(const std::vector<NodeId>& ids, const std::set<NodeId>& skip) {
+    std::vector<NodeRef> succs(ids.size());
+    NodeRef succ = getSuccessor();
+
+    // group ids by the hop that knows more about them, keyed by its address
+    struct SubBatch
+    {
+        NodeRef node;
+        std::vector<size_t> index;
+        bool ok;
+    };
+    std::map<uint64_t, SubBatch> hops;
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+        NodeRef next = self;
+        if (!within(ids[i].data(), this->getId(), succ.id.data())) {
+            next = closetPrecedingNode(ids[i], skip);
+        }
+        if (next.id == self.id) {
+            succs[i] = succ;
+            continue;
+        }
+        auto& hop = hops[peer_key(next.address)];
+        hop.node  = next;
+        hop.index.push_back(i);
+    }
+
+    auto forward = [&ids, &succs](SubBatch* hop) {
+        std::vector<NodeId> sub;
+        for (auto i : hop->index) {
+            sub.push_back(ids[i]);
         }
+        int32_t busy = ConnectionPool::Instance().busyFor(hop->node.address);
+        if (busy > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(busy));
+        }
+        std::vector<NodeRef> found;
+        hop->ok = ConnectionPool::Instance().call(hop->node.address, [&sub, &found](Channel* channel) {
+            return rpc_send_find_successor_batch(channel, sub, &found);
+        });
+        if (hop->ok) {
+            for (size_t k = 0; k < found.size(); ++k) {
+                succs[hop->index[k]] = found[k];
+            }
+        }
+    };
+
+    // all sub-batches are in flight together, the last one runs on this thread
+    std::vector<std::future<void>> pending;
+    SubBatch* last = nullptr;
+    for (auto& h : hops) {
+        if (last != nullptr && parallel_batches) {
+            pending.push_back(std::async(std::launch::async, forward, last));
+        } else if (last != nullptr) {
+            forward(last);
+        }
+        last = &h.second;
+    }
+    if (last != nullptr) {
+        forward(last);
+    }
+    for (auto& p : pending) {
+        p.get();
+    }
+
+    // the ids of failed hops go around them, as in findSuccessor()
+    std::vector<size_t> retry;
+    std::set<NodeId> shed = skip;
+    for (auto& h : hops) {
+        if (!h.second.ok) {
+            if (ConnectionPool::Instance().shedding(h.second.node.address)) {
+                shed.insert(h.second.node.id);
+            }
+            hopFailed(h.second.node);
+            retry.insert(retry.end(), h.second.index.begin(), h.second.index.end());
+        }
+    }
+    if (!retry.empty()) {
+        std::vector<NodeId> rest;
+        for (auto i : retry) {
+            rest.push_back(ids[i]);
+        }
+        auto found = findSuccessorBatch(rest, shed);
+        for (size_t k = 0; k < retry.size(); ++k) {
+            succs[retry[k]] = found[k];
+        }
+    }
+    return succs;
+}
+
+NodeRef Node::closetPrecedingNode(const NodeId& id, const std::set<NodeId>& skip) {
+    std::vector<NodeRef> nodes = closestPrecedingNodes(id, kProximityCandidates, skip);
+    if (nodes.empty()) {
+        return self;
+    }
+
+    // a nearer node that makes less progress can still be the faster route:
+    // a lookup takes about half a hop per bit of distance left, and a hop
+    // costs about the mean RTT of the candidates
+    Coordinate local = Vivaldi::Instance().local();
+    double mean      = 0;
+    for (auto& n : nodes) {
+        if (!local.known() || !n.coord.known()) {
+            return nodes.front();
+        }
+        mean += local.rtt(n.coord) / nodes.size();
+    }
+    int closest = distance_bits(nodes.front().id, id);
+    size_t best = 0;
+    double cost = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        double c = local.rtt(nodes[i].coord) + mean * 0.5 * (distance_bits(nodes[i].id, id) - closest);
+        if (i == 0 || c < cost) {
+            best = i;
+            cost = c;
+        }
+    }
+    return nodes[best];
+}
+
+std::vector<NodeRef> Node::closestPrecedingNodes(const NodeId& id, size_t count, const std::set<NodeId>& skip) {
+    auto state                 = routing.read();
+    std::vector<NodeRef> nodes = state->fingers.closestPreceding(id, count + skip.size());
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [&skip](const NodeRef& n) { return skip.count(n.id) > 0; }),
+                nodes.end());
+    // right after a failure the successor list may know closer nodes
+    for (auto& succ : state->succ_list) {
+        if (succ.id == self.id || skip.count(succ.id) > 0 || !within(succ.id.data(), this->getId(), id.data())) {
+            continue;
+        }
+        bool known = false;
+        for (auto& n : nodes) {
+            known = known || n.id == succ.id;
+        }
+        if (!known) {
+            nodes.push_back(succ);
+        }
+    }
+    // closest to id first
+    std::sort(nodes.begin(), nodes.end(), [&id](const NodeRef& a, const NodeRef& b) {
+        return a.id != b.id && within(a.id.data(), b.id.data(), id.data());
+    });
+    // nodes that shed a call are routed around, as long as another one makes progress
+    auto ready = std::stable_partition(nodes.begin(), nodes.end(), [](const NodeRef& n) {
+        return ConnectionPool::Instance().busyFor(n.address) == 0;
+    });
+    if (ready != nodes.begin()) {
+        nodes.erase(ready, nodes.end());
+    }
+    if (nodes.size() > count) {
+        nodes.resize(count);
+    }
+    return nodes;
+}
+
+NodeRef Node::findSuccessorIterative(const NodeId& id, NodeRef* pred) {
+    NodeRef succ = getSuccessor();
+    if (within(id.data(), this->getId(), succ.id.data())) {
+        if (pred != nullptr) {
+            *pred = self;
+        }
+        return succ;
+    }
+
+    // every node known to precede id, the closest unqueried one is asked next
+    std::vector<NodeRef> candidates;
+    std::set<NodeId> seen;
+    std::set<NodeId> queried;
+    auto consider = [this, &id, &candidates, &seen](const NodeRef& c) {
+        if (within(c.id.data(), this->getId(), id.data()) && seen.insert(c.id).second) {
+            candidates.push_back(c);
+        }
+    };
+    for (auto& n : closestPrecedingNodes(id, alpha)) {
+        consider(n);
+    }
+
+    // the queries go out together, their replies come back on the reader
+    // threads of the channels and this thread takes them one by one
+    auto state = std::make_shared<IterativeLookup>();
+    std::map<NodeId, NextHopQuery> inflight;
+    auto send = [this, &state, &id, &inflight](const NodeRef& target, bool retried) {
+        NextHopQuery query;
+        if (!query_next_hop(state, target, id, alpha, retried, &query)) {
+            hopFailed(target);
+            return;
+        }
+        inflight[target.id] = query;
+    };
+    // the queries still out are abandoned once the lookup is done
+    auto abandon = [&inflight] {
+        for (auto& q : inflight) {
+            q.second.channel->cancel(q.second.call);
+        }
+    };
+
+    while (1) {
+        while (inflight.size() < (size_t)alpha) {
+            const NodeRef* best = nullptr;
+            for (auto& c : candidates) {
+                if (queried.count(c.id) == 0 && (best == nullptr || within(c.id.data(), best->id.data(), id.data()))) {
+                    best = &c;
+                }
+            }
+            if (best == nullptr) {
+                break;
+            }
+            queried.insert(best->id);
+            send(*best, false);
+        }
+
+        if (inflight.empty()) {
+            LOG(WARNING) << "Iterative lookup ran out of candidates, falling back to a recursive lookup";
+            return findSuccessor(id, pred);
+        }
+
+        // the query that waits longest times out first
+        auto deadline = inflight.begin()->second.deadline;
+        for (auto& q : inflight) {
+            deadline = std::min(deadline, q.second.deadline);
+        }
+        IterativeLookup::Reply reply;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (!state->cv.wait_until(lock, deadline, [&state] { return !state->replies.empty(); })) {
+                lock.unlock();
+                // a cancelled query reports as failed, and is taken from the replies
+                for (auto& q : inflight) {
+                    if (q.second.deadline <= deadline) {
+                        q.second.channel->cancel(q.second.call);
+                    }
+                }
+                continue;
+            }
+            reply = std::move(state->replies.front());
+            state->replies.pop_front();
+        }
+        inflight.erase(reply.from.id);
+
+        // a dead or busy candidate is simply replaced by the next closest one
+        if (!reply.ok && reply.broken) {
+            ConnectionPool::Instance().invalidate(reply.from.address);
+            send(reply.from, true);
+            continue;
+        }
+        if (!reply.ok) {
+            hopFailed(reply.from);
+            continue;
+        }
+        learn(reply.from);
+        NodeRef found;
+        if (reply.hop.has_successor() && NodeRef::fromProto(reply.hop.successor(), &found)) {
+            abandon();
+            learn(found);
+            if (pred != nullptr) {
+                *pred = reply.from;
+            }
+            return found;
+        }
+        for (auto& c : reply.hop.candidates()) {
+            NodeRef candidate;
+            if (NodeRef::fromProto(c, &candidate)) {
+                consider(candidate);
+            }
+        }
+    }
+}
+
+void Node::learn(const NodeRef& node) {
+    // most nodes met are known already, do not copy the state for them
+    Coordinate local = Vivaldi::Instance().local();
+    if (!routing.read()->fingers.improves(node, local)) {
+        return;
+    }
+    routing.update([&node, &local](RoutingState& state) { return state.fingers.learn(node, local); });
+}
+
+void Node::hopFailed(const NodeRef& node) {
+    if (ConnectionPool::Instance().shedding(node.address)) {
+        return;
+    }
+    LOG(WARNING) << "Next hop " << node.addr() << ":" << node.port << " has failed";
+    evict(node);
+}
+
+void Node::evict(const NodeRef& node) {
+    churn();
+    ConnectionPool::Instance().invalidate(node.address);
+    cache.invalidate(node.id);
+    routing.update([this, &node](RoutingState& state) {
+        bool changed = state.fingers.remove(node.id);
+
+        auto& list = state.succ_list;
+        auto dead  = std::remove_if(list.begin(), list.end(), [&node](const NodeRef& n) { return n.id == node.id; });
+        changed    = changed || dead != list.end();
+        list.erase(dead, list.end());
+
+        if (state.successor.id == node.id) {
+            // without a successor list, the nearest finger is the best guess
+            state.successor = list.empty() ? state.fingers.nearest() : list.front();
+            if (list.empty()) {
+                list.push_back(state.successor);
+            }
+            changed = true;
+        }
+        if (state.predecessor.id == node.id) {
+            state.predecessor = NodeRef();
+            changed           = true;
+        }
+        return changed;
+    });
+}
+
+#ifdef CHORD_WITH_COROUTINES
+Task<bool> get_predecessor_co(NodeRef node, NodeRef* pred) {
+    return ConnectionPool::Instance().callCo(
+        node.address, [pred](std::shared_ptr<Channel> channel) { return rpc_send_get_predecessor_co(channel, pred); });
+}
+
+Task<bool> get_successor_list_co(NodeRef node, NodeId self, std::vector<NodeRef>* succs) {
+    return ConnectionPool::Instance().callCo(node.address, [self, succs](std::shared_ptr<Channel> channel) {
+        return rpc_send_get_successor_list_co(channel, self, succs);
+    });
+}
+
+/*! \brief the ids of a batch lookup that go to the same next hop. */
+struct HopBatch
+{
+    NodeRef node;
+    std::vector<NodeId> ids;
+    std::vector<size_t> index;
+    std::vector<NodeRef> found;
+    bool ok;
+};
+
+Task<void> forward_batch_co(HopBatch* hop) {
+    int32_t busy = ConnectionPool::Instance().busyFor(hop->node.address);
+    if (busy > 0) {
+        co_await Executor::Instance().sleep(busy);
+    }
+    hop->ok = co_await ConnectionPool::Instance().callCo(hop->node.address, [hop](std::shared_ptr<Channel> channel) {
+        return rpc_send_find_successor_batch_co(channel, hop->ids, &hop->found);
+    });
+}
+
+Task<void> Node::notifyCo() {
+    NodeRef succ = getSuccessor();
+
+    NodeRef me    = self;
+    me.coord      = Vivaldi::Instance().local();
+    bool notified = co_await ConnectionPool::Instance().callCo(
+        succ.address, [me](std::shared_ptr<Channel> channel) { return rpc_send_notify_co(channel, me); });
+    if (!notified) {
+        LOG(WARNING) << "Failed to notify successor";
+    }
+}
+
+Task<void> Node::stabilizeCo() {
+    LOG(INFO) << "[stabilize] called periodically.";
+
+    NodeRef succ = getSuccessor();
+    NodeRef pred;
+    while (!co_await get_predecessor_co(succ, &pred)) {
+        LOG(WARNING) << "Successor " << succ.addr() << ":" << succ.port << " has failed";
+        if (succ.id == self.id) {
+            co_return;
+        }
+        evict(succ);
+        succ = getSuccessor();
+    }
+
+    if (succ.id == self.id && join_address.sin_port != 0) {
+        NodeRef found;
+        bool rejoined = co_await ConnectionPool::Instance().callCo(
+            join_address, [this, &found](std::shared_ptr<Channel> channel) {
+                return rpc_send_find_successor_co(channel, self.id, &found, nullptr);
+            });
+        if (rejoined && found.id != self.id) {
+            setSuccessor(found, std::vector<NodeRef>());
+            churn();
+            co_return;
+        }
+    }
+
+    std::vector<NodeRef> succs;
+    if (pred.valid() && within(pred.id.data(), this->getId(), succ.id.data()) &&
+        co_await get_successor_list_co(pred, self.id, &succs)) {
+        succ = pred;
+    } else if (!co_await get_successor_list_co(succ, self.id, &succs)) {
+        LOG(WARNING) << "Failed to get the successor list";
+        churn();
+        co_return;
+    }
 
-        delete pred;
+    bool changed = setSuccessor(succ, succs);
+    co_await notifyCo();
+    if (changed) {
+        churn();
+    } else {
+        tv_stabilize.stable();
     }
 }
 
-Node* Node::findSuccessor(const uint8_t* id) {
-    if (within(id, this->getId(), (const uint8_t*)successor->id().c_str())) {
-        return new chord::Node(*successor);
+Task<void> Node::fixFingersCo() {
+    LOG(INFO) << "[fix fingers] called periodically.";
+    std::vector<size_t> index;
+    std::vector<NodeId> targets;
+    nextFingers(&index, &targets);
+
+    auto succs = co_await findSuccessorBatchCo(targets);
+
+    Coordinate local = Vivaldi::Instance().local();
+    std::map<NodeId, std::vector<NodeRef>> after;
+    if (local.known()) {
+        for (auto& s : succs) {
+            if (s.id != self.id && after.count(s.id) == 0 &&
+                !co_await get_successor_list_co(s, self.id, &after[s.id])) {
+                after[s.id].clear();
+            }
+        }
+    }
+    if (setFingers(index, succs, local, after)) {
+        churn();
     } else {
-        auto node = closetPrecedingNode(id);
+        tv_fix_fingers.stable();
+    }
+}
 
-        struct sockaddr_in addr;
-        CHECK_GE(inet_pton(AF_INET, node->getAddr().c_str(), &addr.sin_addr.s_addr), 1) << "Invalid IPv4 address";
-        addr.sin_port   = htons(node->getPort());
-        addr.sin_family = AF_INET;
+Task<void> Node::checkPredecessorCo() {
+    LOG(INFO) << "[checkPredecessor] called periodically.";
+    NodeRef pred = getPredecessor();
+    if (pred.valid() && !co_await ConnectionPool::Instance().callCo(pred.address, rpc_send_check_predecessor_co)) {
+        predecessorFailed(pred);
+    } else {
+        tv_check_predecessor.stable();
+    }
+}
 
-        int32_t peer_sockfd;
-        CHECK_GE(peer_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), 0) << "Failed to create socket";
+Task<NodeRef> Node::findSuccessorCo(NodeId id, NodeRef* pred) {
+    // as in findSuccessor(), a hop that shed the call is waited for once
+    std::set<NodeId> shed;
+    while (1) {
+        NodeRef succ = getSuccessor();
+        if (within(id.data(), this->getId(), succ.id.data())) {
+            if (pred != nullptr) {
+                *pred = self;
+            }
+            co_return succ;
+        }
+        NodeRef node = closetPrecedingNode(id, shed);
+        if (node.id == self.id) {
+            co_return succ;
+        }
 
-        if (connect(peer_sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-            close(peer_sockfd);
-            LOG(FATAL) << "Failed to connect to server";
+        int32_t busy = ConnectionPool::Instance().busyFor(node.address);
+        if (busy > 0) {
+            co_await Executor::Instance().sleep(busy);
         }
 
-        rpc_send_find_successor(peer_sockfd, node);
-        return new chord::Node(*node->successor);
+        NodeRef found;
+        bool ok = co_await ConnectionPool::Instance().callCo(
+            node.address, [id, &found, pred](std::shared_ptr<Channel> channel) {
+                return rpc_send_find_successor_co(channel, id, &found, pred);
+            });
+        if (ok) {
+            co_return found;
+        }
+        if (ConnectionPool::Instance().shedding(node.address)) {
+            shed.insert(node.id);
+        }
+        hopFailed(node);
     }
 }
 
-Node* Node::closetPrecedingNode(const uint8_t* id) {
-    for (int i = finger_table.size() - 1; i >= 0; i--) {
-        if (within(finger_table[i]->getId(), this->getId(), id)) {
-            return finger_table[i];
+Task<std::vector<NodeRef>> Node::findSuccessorBatchCo(std::vector<NodeId> ids, std::set<NodeId> skip) {
+    std::vector<NodeRef> succs(ids.size());
+    NodeRef succ = getSuccessor();
+
+    // grouped as in findSuccessorBatch()
+    std::map<uint64_t, HopBatch> hops;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        NodeRef next = self;
+        if (!within(ids[i].data(), this->getId(), succ.id.data())) {
+            next = closetPrecedingNode(ids[i], skip);
+        }
+        if (next.id == self.id) {
+            succs[i] = succ;
+            continue;
+        }
+        auto& hop = hops[peer_key(next.address)];
+        hop.node  = next;
+        hop.ids.push_back(ids[i]);
+        hop.index.push_back(i);
+    }
+
+    std::vector<Task<void>> forwards;
+    for (auto& h : hops) {
+        if (parallel_batches) {
+            forwards.push_back(forward_batch_co(&h.second));
+        } else {
+            co_await forward_batch_co(&h.second);
+        }
+    }
+    co_await all(std::move(forwards));
+
+    std::vector<size_t> retry;
+    for (auto& h : hops) {
+        if (!h.second.ok) {
+            if (ConnectionPool::Instance().shedding(h.second.node.address)) {
+                skip.insert(h.second.node.id);
+            }
+            hopFailed(h.second.node);
+            retry.insert(retry.end(), h.second.index.begin(), h.second.index.end());
+            continue;
+        }
+        for (size_t k = 0; k < h.second.found.size(); ++k) {
+            succs[h.second.index[k]] = h.second.found[k];
+        }
+    }
+    if (!retry.empty()) {
+        std::vector<NodeId> rest;
+        for (auto i : retry) {
+            rest.push_back(ids[i]);
+        }
+        auto found = co_await findSuccessorBatchCo(rest, skip);
+        for (size_t k = 0; k < retry.size(); ++k) {
+            succs[retry[k]] = found[k];
         }
     }
-    return this;
+    co_return succs;
 }
+#endif  // CHORD_WITH_COROUTINES
 
 }  // namespace chord
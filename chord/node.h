@@ -1,40 +1,68 @@
 #pragma once
 
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "async_lookup.h"
 #include "chord.h"
+#include "common/adaptive_interval.h"
 #include "common/bigint.h"
+#include "common/coro.h"
+#include "common/node_ref.h"
+#include "common/rcu.h"
+#include "lookup_cache.h"
+#include "routing_table.h"
 
 namespace chord {
+
+/*! \brief everything a node knows about the ring, published as one immutable version. */
+struct RoutingState
+{
+    NodeRef predecessor;
+    NodeRef successor;
+    // the first r successors, succ_list[0] is successor
+    std::vector<NodeRef> succ_list;
+    RoutingTable fingers;
+};
+
 class Node {
    public:
     // marshalling attributes
-    uint8_t* id;
-    std::string addr;
-    std::int16_t port;
+    NodeRef self;
 
    public:
     int32_t r;
-    protocol::Node* predecessor;
-    protocol::Node* successor;
-    std::deque<Node*> succ_list;
-    std::deque<Node*> finger_table;
+    bool iterative;
+    int32_t alpha;
+    // forward the sub-batches of findSuccessorBatch() on threads of their
+    // own, a simulator running every node on one thread turns it off
+    bool parallel_batches;
+
+    // RPC workers read the routing state while the timers update it, every
+    // update publishes a new version and readers keep the one they pinned
+    Rcu<RoutingState> routing;
+
+    // owners of recent lookups, dropped when membership changes around them
+    LookupCache cache;
+
+    // the next finger fixFingers() refreshes, counting from 1
+    size_t next_finger;
 
    public:
     int32_t server_sockfd;
-    struct sockaddr_in address;
     struct sockaddr_in join_address;
 
    public:
-    /*! \brief A type for seconds */
-    typedef double Milliseconds;
-    Milliseconds tv_stabilize;
-    Milliseconds tv_fix_fingers;
-    Milliseconds tv_check_predecessor;
+    // periods of the maintenance tasks, between the bounds of their flags
+    AdaptiveInterval tv_stabilize;
+    AdaptiveInterval tv_fix_fingers;
+    AdaptiveInterval tv_check_predecessor;
 
    public:
     Node();
 
-    Node(const protocol::Node& node);
-
    public:
     /*! \brief creates a new Chord ring. */
     void create();
@@ -45,21 +73,48 @@ class Node {
     /*! \brief looks up a value from Chord. */
     void lookup(std::string key);
 
+    /**
+     * \brief  starts looking up the owner of key and returns at once. done
+     *         runs exactly once, with the owner, or when the lookup failed,
+     *         was cancelled or missed its deadline. It runs on the lookup
+     *         thread, or on the thread that completes the lookup otherwise,
+     *         and must not block.
+     * \return the lookup, to cancel it.
+     */
+    std::shared_ptr<PendingLookup> lookupAsync(const std::string& key, LookupCallback done,
+                                               int32_t timeout_ms = kLookupTimeoutMs);
+
+    /*! \brief like lookupAsync() with a callback, handle is set to the lookup if given. */
+    std::future<LookupResult> lookupAsync(const std::string& key, int32_t timeout_ms = kLookupTimeoutMs,
+                                          std::shared_ptr<PendingLookup>* handle = nullptr);
+
     /*! \brief prints its local state information at the current time. */
     void dump();
 
+    /*! \brief prints counters of its caches, and the current maintenance periods. */
+    void stats();
+
+    /*! \brief the ring changed around this node, every maintenance task drops to its shortest period. */
+    void churn();
+
    public:
-    inline const uint8_t* getId() { return id; }
+    inline const uint8_t* getId() { return self.id.data(); }
+
+    inline const uint16_t getPort() { return self.port; }
 
-    inline const int16_t getPort() { return ntohs(address.sin_port); }
+    inline const std::string getAddr() { return self.addr(); }
 
-    inline const std::string getAddr() { return inet_ntoa(address.sin_addr); }
+    /*! \brief copies out of the current routing state. */
+    NodeRef getSuccessor();
+    NodeRef getPredecessor();
+    std::vector<NodeRef> getSuccessorList();
 
    public:
     void rpc_server();
 
     /**
-     * \brief  verifies its immediate successor, and tells the successor.
+     * \brief  verifies its immediate successor, skipping failed ones, refreshes
+     *         the successor list from it, and tells the successor.
      * \note   called periodically.
      */
     void stabilize();
@@ -68,8 +123,8 @@ class Node {
     void initFingers();
 
     /**
-     * \brief  refreshes finger table entries. next stores the index of
-     *         the next finger to fix.
+     * \brief  refreshes finger table entries. next_finger stores the index
+     *         of the next finger to fix.
      * \note   called periodically.
      */
     void fixFingers();
@@ -80,14 +135,101 @@ class Node {
      */
     void checkPredecessor();
 
+#ifdef CHORD_WITH_COROUTINES
+   public:
+    /**
+     * \brief  the same protocols as coroutines on the executor. A round
+     *         suspends while it waits for replies instead of holding a thread.
+     */
+    Task<void> stabilizeCo();
+    Task<void> fixFingersCo();
+    Task<void> checkPredecessorCo();
+    Task<void> notifyCo();
+    Task<NodeRef> findSuccessorCo(NodeId id, NodeRef* pred = nullptr);
+    Task<std::vector<NodeRef>> findSuccessorBatchCo(std::vector<NodeId> ids, std::set<NodeId> skip = {});
+#endif
+
    public:
     /*! \brief this thinks it might be successor's predecessor. */
     void notify();
 
-    /*! \brief asks node to find the successor of id. */
-    Node* findSuccessor(const uint8_t* id);
+    /**
+     * \brief  asks node to find the successor of id. pred, if given, is set
+     *         to the node that resolved it, the successor owns (pred, succ].
+     */
+    NodeRef findSuccessor(const NodeId& id, NodeRef* pred = nullptr);
+
+    /**
+     * \brief  finds the successors of many ids together. Ids resolved by the
+     *         local state are answered here, the rest are forwarded as one
+     *         sub-batch per distinct next hop. The ids of a hop that shed
+     *         them are retried once around it, skip holds such hops.
+     */
+    std::vector<NodeRef> findSuccessorBatch(const std::vector<NodeId>& ids,
+                                            const std::set<NodeId>& skip = std::set<NodeId>());
 
-    /*! \brief searches the local table for the highest predecessor of id. */
-    Node* closetPrecedingNode(const uint8_t* id);
+    /**
+     * \brief  searches the local table for the highest predecessor of id, or
+     *         returns self. Nodes in skip, hops that shed the lookup already,
+     *         are left out.
+     */
+    NodeRef closetPrecedingNode(const NodeId& id, const std::set<NodeId>& skip = std::set<NodeId>());
+
+    /*! \brief the up to count distinct nodes of the local table that most closely precede id, but those in skip. */
+    std::vector<NodeRef> closestPrecedingNodes(const NodeId& id, size_t count,
+                                               const std::set<NodeId>& skip = std::set<NodeId>());
+
+    /**
+     * \brief  looks up the successor of id iteratively: this node drives
+     *         every hop itself, keeping up to alpha queries to the closest
+     *         known predecessors of id in flight and going on with the first
+     *         good answer, so one slow hop does not hold up the lookup.
+     */
+    NodeRef findSuccessorIterative(const NodeId& id, NodeRef* pred = nullptr);
+
+    /*! \brief lets a node met during a lookup replace fingers it succeeds more closely. */
+    void learn(const NodeRef& node);
+
+    /**
+     * \brief  takes an asynchronous lookup one hop further, or completes it.
+     *         retried is set when the hop is retried on a fresh channel.
+     */
+    void lookupStep(const std::shared_ptr<PendingLookup>& lookup, bool retried = false);
+
+    /*! \brief sends the hop of lookup to node over channel, the reply takes the next step. */
+    void lookupHop(const std::shared_ptr<PendingLookup>& lookup, const NodeRef& node,
+                   const std::shared_ptr<Channel>& channel, bool reused, bool retried);
+
+    /**
+     * \brief  makes succ the successor, followed by succs, the successor list of succ.
+     * \return true if that changed the successor or the successor list.
+     */
+    bool setSuccessor(const NodeRef& succ, const std::vector<NodeRef>& succs);
+
+    /*! \brief the indices of the next fingers to fix, and the starts of their intervals. */
+    void nextFingers(std::vector<size_t>* index, std::vector<NodeId>* targets);
+
+    /**
+     * \brief  sets the fingers at index to succs, or to nodes nearer to local
+     *         in their intervals, taken from after, the successor lists of succs.
+     * \return true if that changed any of them.
+     */
+    bool setFingers(const std::vector<size_t>& index, const std::vector<NodeRef>& succs, const Coordinate& local,
+                    const std::map<NodeId, std::vector<NodeRef>>& after);
+
+    /*! \brief forgets pred, unless another node became the predecessor meanwhile. */
+    void predecessorFailed(const NodeRef& pred);
+
+    /**
+     * \brief  forgets a node that failed to answer. If it was the successor,
+     *         the next one in the successor list takes over at once.
+     */
+    void evict(const NodeRef& node);
+
+    /**
+     * \brief  a hop to node failed. A node that only shed the call as busy is
+     *         kept, and routed around while its backoff lasts, any other is evicted.
+     */
+    void hopFailed(const NodeRef& node);
 };
 }  // namespace chord
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "routing_table.h"
+#include "common/bigint.h"
+
+namespace chord {
+
+namespace {
+
+/*! \brief to - from on the ring. */
+NodeId distance(const NodeId& from, const NodeId& to) {
+    NodeId d = to;
+    sub(from.data(), d.data());
+    return d;
+}
+
+}  // namespace
+
+void RoutingTable::reset(const NodeRef& self) {
+    self_ = self;
+    for (size_t i = 0; i < kFingers; ++i) {
+        pow2(i, starts_[i].data());
+        add(self.id.data(), starts_[i].data());
+        slot_[i] = kSelf;
+    }
+    peers_.clear();
+}
+
+void RoutingTable::set(size_t i, const NodeRef& node) {
+    uint8_t index = intern(node);
+    uint8_t old   = slot_[i];
+    slot_[i]      = index;
+    if (index != kSelf) {
+        ++peers_[index].refs;
+    }
+    release(old);
+}
+
+size_t RoutingTable::lowerBound(const NodeId& d) const {
+    size_t lo = 0;
+    size_t hi = peers_.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (peers_[mid].distance < d) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t RoutingTable::preceding(const NodeId& id) const {
+    // (self, self] is the whole ring but self
+    if (id == self_.id) {
+        return peers_.size();
+    }
+    NodeId d = distance(self_.id, id);
+    size_t n = lowerBound(d);
+    return n < peers_.size() && peers_[n].distance == d ? n + 1 : n;
+}
+
+const NodeRef& RoutingTable::closestPreceding(const NodeId& id) const {
+    size_t n = preceding(id);
+    return n == 0 ? self_ : peers_[n - 1].node;
+}
+
+std::vector<NodeRef> RoutingTable::closestPreceding(const NodeId& id, size_t count) const {
+    std::vector<NodeRef> nodes;
+    for (size_t n = preceding(id); n > 0 && nodes.size() < count; --n) {
+        nodes.push_back(peers_[n - 1].node);
+    }
+    return nodes;
+}
+
+bool RoutingTable::inInterval(size_t i, const NodeId& node) const {
+    const NodeId& end = i + 1 < kFingers ? starts_[i + 1] : self_.id;
+    return distance(starts_[i], node) < distance(starts_[i], end);
+}
+
+bool RoutingTable::closer(size_t i, const NodeRef& node, const Coordinate& local) const {
+    // node lies in [start, finger) if it is nearer to start than the finger
+    // is, a finger exactly at start cannot be improved on
+    const NodeRef& current = finger(i);
+    if (current.id == node.id || !(distance(starts_[i], node.id) < distance(starts_[i], current.id))) {
+        return false;
+    }
+    // a finger picked for proximity stays if it is still correct
+    if (inInterval(i, current.id) && local.known() && current.coord.known() && node.coord.known()) {
+        return local.rtt(node.coord) < local.rtt(current.coord);
+    }
+    return true;
+}
+
+bool RoutingTable::learn(const NodeRef& node, const Coordinate& local) {
+    if (!node.valid() || node.id == self_.id) {
+        return false;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < kFingers; ++i) {
+        if (closer(i, node, local)) {
+            set(i, node);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool RoutingTable::improves(const NodeRef& node, const Coordinate& local) const {
+    if (!node.valid() || node.id == self_.id) {
+        return false;
+    }
+    for (size_t i = 0; i < kFingers; ++i) {
+        if (closer(i, node, local)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RoutingTable::remove(const NodeId& id) {
+    if (id == self_.id) {
+        return false;
+    }
+    NodeId d     = distance(self_.id, id);
+    size_t index = lowerBound(d);
+    if (index == peers_.size() || peers_[index].distance != d) {
+        return false;
+    }
+
+    NodeRef next = peers_.size() > 1 ? peers_[(index + 1) % peers_.size()].node : self_;
+    for (size_t i = 0; i < kFingers; ++i) {
+        if (slot_[i] == index) {
+            set(i, next);
+        }
+    }
+    return true;
+}
+
+uint8_t RoutingTable::intern(const NodeRef& node) {
+    if (!node.valid() || node.id == self_.id) {
+        return kSelf;
+    }
+    NodeId d     = distance(self_.id, node.id);
+    size_t index = lowerBound(d);
+    if (index < peers_.size() && peers_[index].distance == d) {
+        peers_[index].node = node;
+        return index;
+    }
+
+    Peer peer;
+    peer.distance = d;
+    peer.node     = node;
+    peer.refs     = 0;
+    peers_.insert(peers_.begin() + index, peer);
+    for (auto& s : slot_) {
+        if (s != kSelf && s >= index) {
+            ++s;
+        }
+    }
+    return index;
+}
+
+void RoutingTable::release(uint8_t index) {
+    if (index == kSelf || --peers_[index].refs > 0) {
+        return;
+    }
+    peers_.erase(peers_.begin() + index);
+    for (auto& s : slot_) {
+        if (s != kSelf && s > index) {
+            --s;
+        }
+    }
+}
+
+}  // namespace chord
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <openssl/sha.h>
+#include <stdint.h>
+#include <vector>
+
+#include "common/node_ref.h"
+
+namespace chord {
+
+/*! \brief one finger per bit of an id. */
+const size_t kFingers = SHA_DIGEST_LENGTH * 8;
+
+/**
+ * \brief  the finger table of a node. Consecutive fingers mostly point at the
+ *         same few peers, so every distinct peer is stored once, in a vector
+ *         sorted by its clockwise distance from the node, and a finger is a
+ *         one byte index into it. The closest preceding peer of an id is then
+ *         a binary search over the distinct peers instead of a scan over all
+ *         fingers. The finger start ids are computed once.
+ * \note   not thread-safe, the node only shares immutable copies of it.
+ */
+class RoutingTable {
+   public:
+    RoutingTable() { reset(NodeRef()); }
+
+    /*! \brief empties the table of the node self, every finger points back at self. */
+    void reset(const NodeRef& self);
+
+    /*! \brief the id finger i succeeds: self + 2^i. */
+    const NodeId& start(size_t i) const { return starts_[i]; }
+
+    /*! \brief the peer finger i points at, or self. */
+    const NodeRef& finger(size_t i) const { return slot_[i] == kSelf ? self_ : peers_[slot_[i]].node; }
+
+    /*! \brief points finger i at node. */
+    void set(size_t i, const NodeRef& node);
+
+    /*! \brief the closest peer in (self, id], or self if there is none. */
+    const NodeRef& closestPreceding(const NodeId& id) const;
+
+    /*! \brief the up to count closest distinct peers in (self, id], closest first. */
+    std::vector<NodeRef> closestPreceding(const NodeId& id, size_t count) const;
+
+    /*! \brief true if node lies in [start(i), start(i + 1)), where any node makes a correct finger i. */
+    bool inInterval(size_t i, const NodeId& node) const;
+
+    /**
+     * \brief  points every finger whose range [start, finger) holds node at
+     *         it, unless the finger already lies in its interval and local
+     *         predicts it to be nearer than node.
+     * \return true if any finger changed.
+     */
+    bool learn(const NodeRef& node, const Coordinate& local);
+
+    /*! \brief true if learn(node, local) would change any finger. */
+    bool improves(const NodeRef& node, const Coordinate& local) const;
+
+    /**
+     * \brief  forgets the peer id. Its fingers fall through to the next
+     *         known peer clockwise, which succeeds their starts if it failed.
+     * \return true if id was in the table.
+     */
+    bool remove(const NodeId& id);
+
+    /*! \brief the nearest peer clockwise, or self. */
+    const NodeRef& nearest() const { return peers_.empty() ? self_ : peers_.front().node; }
+
+    /*! \brief the number of distinct peers in the table. */
+    size_t peers() const { return peers_.size(); }
+
+   private:
+    static const uint8_t kSelf = 0xff;
+    static_assert(kFingers < kSelf, "finger indices must fit a byte");
+
+    struct Peer
+    {
+        NodeId distance;  // node.id - self.id on the ring
+        NodeRef node;
+        uint8_t refs;  // fingers pointing at it
+    };
+
+    /*! \brief true if learn() would point finger i at node. */
+    bool closer(size_t i, const NodeRef& node, const Coordinate& local) const;
+
+    /*! \brief the index of the first peer at distance d or further. */
+    size_t lowerBound(const NodeId& d) const;
+
+    /*! \brief the number of peers in (self, id]. */
+    size_t preceding(const NodeId& id) const;
+
+    /*! \brief finds or inserts node, returns its index or kSelf. */
+    uint8_t intern(const NodeRef& node);
+
+    /*! \brief drops a reference to peer index, erasing it with the last one. */
+    void release(uint8_t index);
+
+    NodeRef self_;
+    NodeId starts_[kFingers];
+    uint8_t slot_[kFingers];
+    std::vector<Peer> peers_;
+};
+
+}  // namespace chord
@@ -1,285 +1,633 @@
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <algorithm>
+#include <chrono>
+
 #include "rpc.h"
 #include "chord.h"
-#include "common/net-buffer.h"
-#include "common/socket-util.h"
+#include "common/envelope.h"
+#include "common/fair_queue.h"
+#include "common/reactor.h"
 #include "common/thread_pool.h"
+#include "common/vivaldi.h"
 
 namespace chord {
 
 namespace {
-const std::string kFindSuccessor    = "find_successor";
-const std::string kNotify           = "notify";
-const std::string kGetPredecessor   = "get_predecessor";
-const std::string kCheckPredecessor = "check_predecessor";
-const std::string kGetSuccessorList = "get_successor_list";
-
 const int32_t kPoolSize = 32;
 
-bool send_proto(int32_t peer_sockfd, std::string& binary) {
-    uint64_t packed_size = binary.size() + sizeof(uint64_t);
-    uint8_t* output      = (uint8_t*)malloc(packed_size);
-    memset(output, 0, packed_size);
-    *(reinterpret_cast<uint64_t*>(output)) = htonll(packed_size);
-    memcpy((uint8_t*)output + sizeof(uint64_t), binary.c_str(), binary.size());
+// queued calls past which lookups are shed, and the backoff asked for there,
+// it grows in proportion to the queue up to kMaxBusyBackoffMs
+const int64_t kShedQueueDepth = 4 * kPoolSize;
+const int32_t kBusyBackoffMs  = 50;
+
+// first block of every worker arena, it covers all but the largest requests
+const size_t kArenaBlockSize = 64 * 1024;
+
+/**
+ * \brief  the arena of the calling worker thread. Every message of a request
+ *         is built in it and dropped at once when the request completes, and
+ *         since Reset() keeps the first block, a warm worker serves a request
+ *         without touching the allocator.
+ */
+google::protobuf::Arena& worker_arena() {
+    thread_local std::unique_ptr<char[]> block(new char[kArenaBlockSize]);
+    thread_local google::protobuf::Arena arena([] {
+        google::protobuf::ArenaOptions options;
+        options.initial_block      = block.get();
+        options.initial_block_size = kArenaBlockSize;
+        return options;
+    }());
+    return arena;
+}
 
-    if (send_exact(peer_sockfd, (void*)output, packed_size, 0) <= 0) {
-        close(peer_sockfd);
-        LOG(WARNING) << "Failed to send back";
+/**
+ * \brief  an id off the wire.
+ * \return false for anything but SHA_DIGEST_LENGTH bytes, a corrupt request.
+ */
+bool id_of(const std::string& bytes, NodeId* id) {
+    if (bytes.size() != SHA_DIGEST_LENGTH) {
         return false;
     }
-    free(output);
+    *id = NodeId::from(bytes.data());
     return true;
 }
 
-uint64_t recv_proto(int32_t peer_sockfd, uint8_t** recv_buf) {
-    *recv_buf = (uint8_t*)malloc(sizeof(uint64_t));
-    NetBuffer net_buf;
-    netbuf_init(&net_buf, *recv_buf, sizeof(uint64_t));
-    if (recv_exact(peer_sockfd, *recv_buf, sizeof(uint64_t), 0) != sizeof(uint64_t)) {
-        LOG(ERROR) << "Invalid hash request header";
+/*! \brief places this node by the RTT of a call sent at start and answered with response. */
+void observe_rtt(const protocol::Response& response, std::chrono::steady_clock::time_point start) {
+    if (response.has_coord()) {
+        std::chrono::duration<double, std::milli> rtt = std::chrono::steady_clock::now() - start;
+        Vivaldi::Instance().observe(Coordinate::fromProto(response.coord()), rtt.count());
     }
+}
 
-    uint64_t size = 0;
-    read_uint64(&net_buf, &size);
-    free(*recv_buf);
-    uint64_t rest = size - sizeof(uint64_t);
-    *recv_buf     = (uint8_t*)malloc(rest);
-    if (recv_exact(peer_sockfd, *recv_buf, rest, 0) != rest) {
-        LOG(ERROR) << "Invalid hash request args";
+/**
+ * \brief  channel->call(), placing this node by the RTT of the call. Only
+ *         for methods answered from local state, a reply that waited for
+ *         further hops says nothing about the distance to the peer.
+ */
+bool timed_call(Channel* channel, protocol::Request& request, protocol::Response* response) {
+    auto start = std::chrono::steady_clock::now();
+    if (!channel->call(request, response)) {
+        return false;
     }
-    return rest;
+    observe_rtt(*response, start);
+    return true;
 }
 
-}  // namespace
+/*! \brief the owner, and the predecessor of the owner if pred is given, from a find_successor reply. */
+bool parse_find_successor(const protocol::Response& response, NodeRef* succ, NodeRef* pred) {
+    const protocol::FindSuccessorRet& fsret = response.find_successor();
+    if (pred != nullptr) {
+        *pred = NodeRef();
+        if (fsret.has_predecessor()) {
+            NodeRef::fromProto(fsret.predecessor(), pred);
+        }
+    }
+    return fsret.has_node() && NodeRef::fromProto(fsret.node(), succ);
+}
 
-// rpc_join is a blocking request
-bool rpc_send_find_successor(int32_t peer_sockfd, chord::Node* node) {
-    protocol::FindSuccessorArgs args;
-    std::string s(node->getId(), node->getId() + SHA_DIGEST_LENGTH);
-    args.set_id(s);
-    std::string packed_args;
-    CHECK_EQ(args.SerializeToString(&packed_args), true);
-
-    protocol::Call call;
-    call.set_name(kFindSuccessor);
-    call.set_args(packed_args);
-    CHECK_EQ(call.SerializeToString(&packed_args), true);
-
-    send_proto(peer_sockfd, packed_args);
-
-    uint8_t* proto_buff;
-    uint64_t proto_size = recv_proto(peer_sockfd, &proto_buff);
-
-    protocol::Return ret;
-    CHECK_EQ(ret.ParseFromArray(proto_buff, proto_size), true);
-    CHECK_EQ(ret.success(), true);
-    protocol::FindSuccessorRet fsret;
-    CHECK_EQ(fsret.ParseFromString(ret.value()), true);
-    CHECK_EQ(fsret.has_node(), true);
-
-    node->successor = new protocol::Node(fsret.node());
-    // *(node->successor) = fsret.node();
-
-    free(proto_buff);
+/*! \brief makes request a find_successor_batch of ids. */
+void set_find_successor_batch(const std::vector<NodeId>& ids, protocol::Request* request) {
+    protocol::FindSuccessorBatchArgs* args = request->mutable_find_successor_batch();
+    for (auto& id : ids) {
+        args->add_ids(id.data(), SHA_DIGEST_LENGTH);
+    }
+}
+
+/*! \brief the owners of the count ids of a find_successor_batch request, in their order. */
+bool parse_find_successor_batch(const protocol::Response& response, size_t count, std::vector<NodeRef>* succs) {
+    const protocol::FindSuccessorBatchRet& fsret = response.find_successor_batch();
+    if ((size_t)fsret.nodes_size() != count) {
+        LOG(WARNING) << "Batch lookup answered " << fsret.nodes_size() << " of " << count << " ids";
+        return false;
+    }
+
+    succs->resize(count);
+    for (int i = 0; i < fsret.nodes_size(); ++i) {
+        if (!NodeRef::fromProto(fsret.nodes(i), &(*succs)[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void parse_get_predecessor(const protocol::Response& response, NodeRef* pred) {
+    const protocol::GetPredecessorRet& gpret = response.get_predecessor();
+
+    *pred = NodeRef();
+    if (gpret.has_node()) {
+        NodeRef::fromProto(gpret.node(), pred);
+    }
+}
+
+bool parse_get_successor_list(const protocol::Response& response, std::vector<NodeRef>* succs) {
+    const protocol::GetSuccessorListRet& slret = response.get_successor_list();
+
+    succs->resize(slret.successors_size());
+    for (int i = 0; i < slret.successors_size(); ++i) {
+        if (!NodeRef::fromProto(slret.successors(i), &(*succs)[i])) {
+            return false;
+        }
+    }
     return true;
 }
 
-void rpc_recv_find_successor(int32_t peer_sockfd, const protocol::FindSuccessorArgs& args, chord::Node* node) {
-    CHECK_EQ(args.has_id(), true);
-    chord::Node* succ = node->findSuccessor((const uint8_t*)args.id().c_str());
+void raise_to(std::atomic<int64_t>* max, int64_t value) {
+    int64_t current = *max;
+    while (value > current && !max->compare_exchange_weak(current, value)) {
+    }
+}
+
+/**
+ * \brief  the id and method of a call, read off its envelope without
+ *         parsing the arguments, so that the reactor can sort calls cheaply.
+ * \return false if binary is no well-formed envelope of version.
+ */
+bool peek_call(uint8_t version, const std::string& binary, uint64_t* id, uint32_t* method) {
+    using google::protobuf::internal::WireFormatLite;
+    google::protobuf::io::CodedInputStream in((const uint8_t*)binary.data(), binary.size());
+    *id     = 0;
+    *method = 0;
+    while (uint32_t tag = in.ReadTag()) {
+        uint32_t field = WireFormatLite::GetTagFieldNumber(tag);
+        bool ok;
+        if (version == kEnvelopeVersion) {
+            if (field == protocol::Request::kIdFieldNumber) {
+                ok = in.ReadVarint64(id);
+            } else {
+                // the body, its field number is the method
+                *method = field;
+                ok      = WireFormatLite::SkipField(&in, tag);
+            }
+        } else if (field == protocol::Call::kIdFieldNumber) {
+            ok = in.ReadVarint64(id);
+        } else if (field == protocol::Call::kMethodFieldNumber) {
+            ok = in.ReadVarint32(method);
+        } else if (field == protocol::Call::kNameFieldNumber && *method == 0) {
+            // a Call of a node that predates method names it only
+            std::string name;
+            ok = WireFormatLite::ReadString(&in, &name);
+            if (ok) {
+                auto body = protocol::Request::descriptor()->FindFieldByName(name);
+                *method   = body != nullptr && body->containing_oneof() != nullptr ? body->number() : 0;
+            }
+        } else {
+            ok = WireFormatLite::SkipField(&in, tag);
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return in.ConsumedEntireMessage();
+}
+
+/*! \brief answers call id busy without serving it. */
+void shed(Session* session, uint8_t version, uint64_t id, int64_t depth) {
+    protocol::Response response;
+    response.set_id(id);
+    response.set_success(false);
+    response.set_busy_ms(std::min<int64_t>(kBusyBackoffMs * depth / kShedQueueDepth, kMaxBusyBackoffMs));
 
-    protocol::Node* n = new protocol::Node();
-    n->set_address(succ->getAddr());
-    n->set_port(succ->getPort());
-    std::string s(succ->getId(), succ->getId() + SHA_DIGEST_LENGTH);
-    n->set_id(s);
+    std::string packed_ret;
+    if (version == kEnvelopeVersion) {
+        CHECK_EQ(response.SerializeToString(&packed_ret), true);
+    } else {
+        protocol::Return ret;
+        envelope_to_return(response, &ret);
+        CHECK_EQ(ret.SerializeToString(&packed_ret), true);
+    }
+    session->send(packed_ret, version);
+    ++server_stats().shed;
+}
 
-    std::string packed_args;
-    protocol::FindSuccessorRet fsret;
-    fsret.set_allocated_node(n);
-    CHECK_EQ(fsret.SerializeToString(&packed_args), true);
+/*! \brief a call waiting for a worker. */
+struct QueuedCall
+{
+    std::shared_ptr<Session> session;
+    uint8_t version;
+    BufferPool::Buffer frame;
+    bool maintenance;
+};
+
+/*! \brief releases everything allocated in arena when it goes out of scope. */
+struct ArenaScope
+{
+    explicit ArenaScope(google::protobuf::Arena* arena) : arena(arena) {}
+    ~ArenaScope() { arena->Reset(); }
+
+    google::protobuf::Arena* arena;
+};
+}  // namespace
 
-    protocol::Return ret;
-    ret.set_success(true);
-    ret.set_value(packed_args);
-    CHECK_EQ(ret.SerializeToString(&packed_args), true);
+// rpc_join is a blocking request
+bool rpc_send_find_successor(Channel* channel, const NodeId& id, NodeRef* succ, NodeRef* pred) {
+    protocol::Request request;
+    request.mutable_find_successor()->set_id(id.data(), SHA_DIGEST_LENGTH);
 
-    send_proto(peer_sockfd, packed_args);
+    protocol::Response response;
+    return channel->call(request, &response) && parse_find_successor(response, succ, pred);
 }
 
-bool rpc_send_get_predecessor(int32_t peer_sockfd, chord::Node* node) {
-    std::string packed_args;
-    protocol::Call call;
-    protocol::GetPredecessorArgs args;
-    call.set_name(kGetPredecessor);
-    args.SerializeToString(&packed_args);
-    call.set_args(packed_args);
-    CHECK_EQ(call.SerializeToString(&packed_args), true);
+uint64_t rpc_send_find_successor_async(Channel* channel, const NodeId& id,
+                                       std::function<void(bool ok, const NodeRef& succ, const NodeRef& pred)> done) {
+    protocol::Request request;
+    request.mutable_find_successor()->set_id(id.data(), SHA_DIGEST_LENGTH);
+
+    return channel->callAsync(request, [done](bool ok, protocol::Response* response) {
+        NodeRef succ;
+        NodeRef pred;
+        ok = ok && parse_find_successor(*response, &succ, &pred);
+        done(ok, succ, pred);
+    });
+}
 
-    send_proto(peer_sockfd, packed_args);
+bool rpc_recv_find_successor(const protocol::FindSuccessorArgs& args, chord::Node* node,
+                             protocol::FindSuccessorRet* ret) {
+    NodeId id;
+    if (!id_of(args.id(), &id)) {
+        return false;
+    }
+    NodeRef pred;
+    NodeRef succ = node->findSuccessor(id, &pred);
+    succ.toProto(ret->mutable_node());
+    if (pred.valid()) {
+        pred.toProto(ret->mutable_predecessor());
+    }
+    return true;
+}
 
-    uint8_t* proto_buff;
-    uint64_t proto_size = recv_proto(peer_sockfd, &proto_buff);
+bool rpc_send_find_successor_batch(Channel* channel, const std::vector<NodeId>& ids, std::vector<NodeRef>* succs) {
+    protocol::Request request;
+    set_find_successor_batch(ids, &request);
 
-    protocol::Return ret;
-    CHECK_EQ(ret.ParseFromArray(proto_buff, proto_size), true);
-    CHECK_EQ(ret.success(), true);
+    protocol::Response response;
+    return channel->call(request, &response) && parse_find_successor_batch(response, ids.size(), succs);
+}
 
-    protocol::GetPredecessorRet gpret;
-    CHECK_EQ(gpret.ParseFromString(ret.value()), true);
-    if (gpret.has_node() && gpret.node().has_id()) {
-        node->predecessor = new protocol::Node(gpret.node());
-    } else {
-        node->predecessor = nullptr;
+bool rpc_recv_find_successor_batch(const protocol::FindSuccessorBatchArgs& args, chord::Node* node,
+                                   protocol::FindSuccessorBatchRet* ret) {
+    std::vector<NodeId> ids(args.ids_size());
+    for (int i = 0; i < args.ids_size(); ++i) {
+        if (!id_of(args.ids(i), &ids[i])) {
+            return false;
+        }
     }
 
-    free(proto_buff);
+    for (auto& succ : node->findSuccessorBatch(ids)) {
+        succ.toProto(ret->add_nodes());
+    }
     return true;
 }
 
-void rpc_recv_get_predecessor(int32_t peer_sockfd, chord::Node* node) {
-    std::string packed_args;
-    protocol::GetPredecessorRet gpret;
+uint64_t rpc_send_find_next_hop_async(Channel* channel, const NodeId& id, uint32_t count,
+                                      std::function<void(bool ok, protocol::FindNextHopRet* hop)> done) {
+    protocol::Request request;
+    protocol::FindNextHopArgs* args = request.mutable_find_next_hop();
+    args->set_id(id.data(), SHA_DIGEST_LENGTH);
+    args->set_count(count);
+
+    // answered from the state of the peer, the reply times the distance to it as in timed_call()
+    auto start = std::chrono::steady_clock::now();
+    return channel->callAsync(request, [done, start](bool ok, protocol::Response* response) {
+        if (ok) {
+            observe_rtt(*response, start);
+        }
+        done(ok, ok ? response->mutable_find_next_hop() : nullptr);
+    });
+}
+
+bool rpc_recv_find_next_hop(const protocol::FindNextHopArgs& args, chord::Node* node, protocol::FindNextHopRet* ret) {
+    NodeId id;
+    if (!id_of(args.id(), &id)) {
+        return false;
+    }
+    NodeRef succ = node->getSuccessor();
 
-    if (node->predecessor != nullptr && node->predecessor->has_id()) {
-        protocol::Node* pred = new protocol::Node(*node->predecessor);
-        gpret.set_allocated_node(pred);
+    std::vector<NodeRef> candidates;
+    if (!within(id.data(), node->getId(), succ.id.data())) {
+        candidates = node->closestPrecedingNodes(id, args.count());
+    }
+    if (candidates.empty()) {
+        // either the successor owns id, or nothing we know precedes it more closely
+        succ.toProto(ret->mutable_successor());
+    }
+    for (auto& c : candidates) {
+        c.toProto(ret->add_candidates());
     }
-    CHECK_EQ(gpret.SerializeToString(&packed_args), true);
+    return true;
+}
 
-    protocol::Return ret;
-    ret.set_success(true);
-    ret.set_value(packed_args);
-    CHECK_EQ(ret.SerializeToString(&packed_args), true);
+bool rpc_send_get_predecessor(Channel* channel, NodeRef* pred) {
+    protocol::Request request;
+    request.mutable_get_predecessor();
 
-    send_proto(peer_sockfd, packed_args);
+    protocol::Response response;
+    if (!timed_call(channel, request, &response)) {
+        return false;
+    }
+    parse_get_predecessor(response, pred);
+    return true;
 }
 
-bool rpc_send_notify(int32_t peer_sockfd, chord::Node* node) {
-    std::string packed_args;
+bool rpc_recv_get_predecessor(const protocol::GetPredecessorArgs& args, chord::Node* node,
+                              protocol::GetPredecessorRet* ret) {
+    NodeRef pred = node->getPredecessor();
+    if (pred.valid()) {
+        pred.toProto(ret->mutable_node());
+    }
+    return true;
+}
 
-    protocol::Node* n = new protocol::Node();
-    n->set_address(node->getAddr());
-    n->set_port(node->getPort());
-    std::string s(node->getId(), node->getId() + SHA_DIGEST_LENGTH);
-    n->set_id(s);
+bool rpc_send_notify(Channel* channel, const NodeRef& self) {
+    protocol::Request request;
+    self.toProto(request.mutable_notify()->mutable_node());
 
-    protocol::NotifyArgs args;
-    args.set_allocated_node(n);
-    CHECK_EQ(args.SerializeToString(&packed_args), true);
+    protocol::Response response;
+    return channel->call(request, &response);
+}
 
-    protocol::Call call;
-    call.set_name(kNotify);
-    call.set_args(packed_args);
-    CHECK_EQ(call.SerializeToString(&packed_args), true);
+bool rpc_recv_notify(const protocol::NotifyArgs& args, chord::Node* node, protocol::NotifyRet* ret) {
+    NodeRef n;
+    if (!NodeRef::fromProto(args.node(), &n)) {
+        LOG(WARNING) << "Ignoring notify from an invalid node";
+        return false;
+    }
 
-    send_proto(peer_sockfd, packed_args);
+    // the predecessor notifies on every stabilize, usually without news
+    if (node->getPredecessor().id == n.id) {
+        return true;
+    }
+    bool changed = node->routing.update([node, &n](RoutingState& state) {
+        if (state.predecessor.valid() && !within(n.id.data(), state.predecessor.id.data(), node->getId())) {
+            return false;
+        }
+        state.predecessor = n;
+        return true;
+    });
+    if (changed) {
+        // n joined, the ranges cached around it changed owner
+        node->cache.invalidate(n.id);
+        node->churn();
+    }
+    return true;
+}
 
-    uint8_t* proto_buff;
-    uint64_t proto_size = recv_proto(peer_sockfd, &proto_buff);
+bool rpc_send_check_predecessor(Channel* channel) {
+    protocol::Request request;
+    request.mutable_check_predecessor();
 
-    protocol::Return ret;
-    CHECK_EQ(ret.ParseFromArray(proto_buff, proto_size), true);
-    CHECK_EQ(ret.success(), true);
+    protocol::Response response;
+    return timed_call(channel, request, &response);
+}
 
-    free(proto_buff);
+bool rpc_recv_check_predecessor(const protocol::CheckPredecessorArgs& args, chord::Node* node,
+                                protocol::CheckPredecessorRet* ret) {
     return true;
 }
 
-void rpc_recv_notify(int32_t peer_sockfd, const protocol::NotifyArgs& args, chord::Node* node) {
-    protocol::Node n = args.node();
-    if (node->predecessor == nullptr || !node->predecessor->has_id() ||
-        within(n.id().c_str(), node->predecessor->id().c_str(), node->getId())) {
-        node->predecessor = new protocol::Node(n);
+bool rpc_send_get_successor_list(Channel* channel, const NodeId& self, std::vector<NodeRef>* succs) {
+    protocol::Request request;
+    request.mutable_get_successor_list()->set_id(self.data(), SHA_DIGEST_LENGTH);
+
+    protocol::Response response;
+    return timed_call(channel, request, &response) && parse_get_successor_list(response, succs);
+}
+
+bool rpc_recv_get_successor_list(const protocol::GetSuccessorListArgs& args, chord::Node* node,
+                                 protocol::GetSuccessorListRet* ret) {
+    // successors past the caller wrap around the ring, they are no use to it
+    NodeId caller;
+    if (!id_of(args.id(), &caller)) {
+        return false;
+    }
+    for (auto& succ : node->getSuccessorList()) {
+        if (succ.id == caller) {
+            break;
+        }
+        succ.toProto(ret->add_successors());
+    }
+    return true;
+}
+
+#ifdef CHORD_WITH_COROUTINES
+namespace {
+/**
+ * \brief  channel->call() for coroutines. The awaiting coroutine resumes on
+ *         the executor with the reply, or with false once the channel breaks
+ *         or timeout_ms passed, and holds no thread in between.
+ */
+struct CallAwaiter
+{
+    std::shared_ptr<Channel> channel;
+    protocol::Request* request;
+    protocol::Response* response;
+    int32_t timeout_ms;
+    bool ok;
+
+    bool await_ready() { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        std::weak_ptr<Channel> weak = channel;
+        auto deadline               = Executor::Clock::now() + std::chrono::milliseconds(timeout_ms);
+        uint64_t id = channel->callAsync(*request, [this, h](bool success, protocol::Response* reply) {
+            // on the reader thread, nothing but handing the reply over
+            ok = success;
+            if (success) {
+                response->Swap(reply);
+            }
+            Executor::Instance().post(h);
+        });
+        // the coroutine may have resumed and this awaiter be gone by now
+        if (id != 0) {
+            Executor::Instance().postAt(deadline, [weak, id] {
+                std::shared_ptr<Channel> channel = weak.lock();
+                if (channel != nullptr) {
+                    channel->cancel(id);
+                }
+            });
+        }
     }
 
-    std::string packed_args;
-    std::shared_ptr<protocol::Return> ret(new protocol::Return());
-    ret->set_success(true);
-    CHECK_EQ(ret->SerializeToString(&packed_args), true);
-    send_proto(peer_sockfd, packed_args);
+    bool await_resume() { return ok; }
+};
+
+CallAwaiter co_call(const std::shared_ptr<Channel>& channel, protocol::Request& request, protocol::Response* response) {
+    return CallAwaiter{channel, &request, response, kCallTimeoutMs, false};
 }
 
-bool rpc_send_check_predecessor(int32_t peer_sockfd) {
-    std::string packed_args;
+/*! \brief timed_call() for coroutines. */
+Task<bool> co_timed_call(std::shared_ptr<Channel> channel, protocol::Request& request, protocol::Response* response) {
+    auto start = std::chrono::steady_clock::now();
+    if (!co_await co_call(channel, request, response)) {
+        co_return false;
+    }
+    observe_rtt(*response, start);
+    co_return true;
+}
+}  // namespace
 
-    protocol::CheckPredecessorArgs args;
-    CHECK_EQ(args.SerializeToString(&packed_args), true);
+Task<bool> rpc_send_find_successor_co(std::shared_ptr<Channel> channel, NodeId id, NodeRef* succ, NodeRef* pred) {
+    protocol::Request request;
+    request.mutable_find_successor()->set_id(id.data(), SHA_DIGEST_LENGTH);
 
-    protocol::Call call;
-    call.set_name(kCheckPredecessor);
-    call.set_args(packed_args);
-    CHECK_EQ(call.SerializeToString(&packed_args), true);
+    protocol::Response response;
+    co_return co_await co_call(channel, request, &response) && parse_find_successor(response, succ, pred);
+}
 
-    send_proto(peer_sockfd, packed_args);
+Task<bool> rpc_send_find_successor_batch_co(std::shared_ptr<Channel> channel, std::vector<NodeId> ids,
+                                            std::vector<NodeRef>* succs) {
+    protocol::Request request;
+    set_find_successor_batch(ids, &request);
 
-    uint8_t* proto_buff;
-    uint64_t proto_size = recv_proto(peer_sockfd, &proto_buff);
+    protocol::Response response;
+    co_return co_await co_call(channel, request, &response) && parse_find_successor_batch(response, ids.size(), succs);
+}
 
-    protocol::Return ret;
-    CHECK_EQ(ret.ParseFromArray(proto_buff, proto_size), true);
-    CHECK_EQ(ret.success(), true);
+Task<bool> rpc_send_get_predecessor_co(std::shared_ptr<Channel> channel, NodeRef* pred) {
+    protocol::Request request;
+    request.mutable_get_predecessor();
 
-    free(proto_buff);
-    return true;
+    protocol::Response response;
+    if (!co_await co_timed_call(channel, request, &response)) {
+        co_return false;
+    }
+    parse_get_predecessor(response, pred);
+    co_return true;
 }
 
-void rpc_recv_check_predecessor(int32_t peer_sockfd) {
-    std::string packed_args;
-    std::shared_ptr<protocol::Return> ret(new protocol::Return());
-    ret->set_success(true);
-    CHECK_EQ(ret->SerializeToString(&packed_args), true);
-    send_proto(peer_sockfd, packed_args);
+Task<bool> rpc_send_notify_co(std::shared_ptr<Channel> channel, NodeRef self) {
+    protocol::Request request;
+    self.toProto(request.mutable_notify()->mutable_node());
+
+    protocol::Response response;
+    co_return co_await co_call(channel, request, &response);
 }
 
-void rpc_daemon(int32_t server_sockfd, chord::Node* node) {
-    int32_t client_sockfd;
-    struct sockaddr_in client_addr;
-    socklen_t client_len;
+Task<bool> rpc_send_check_predecessor_co(std::shared_ptr<Channel> channel) {
+    protocol::Request request;
+    request.mutable_check_predecessor();
+
+    protocol::Response response;
+    co_return co_await co_timed_call(channel, request, &response);
+}
+
+Task<bool> rpc_send_get_successor_list_co(std::shared_ptr<Channel> channel, NodeId self,
+                                          std::vector<NodeRef>* succs) {
+    protocol::Request request;
+    request.mutable_get_successor_list()->set_id(self.data(), SHA_DIGEST_LENGTH);
+
+    protocol::Response response;
+    co_return co_await co_timed_call(channel, request, &response) && parse_get_successor_list(response, succs);
+}
+#endif  // CHORD_WITH_COROUTINES
+
+ServerStats& server_stats() {
+    static ServerStats stats;
+    return stats;
+}
+
+void rpc_register(RpcRegistry* registry, chord::Node* node) {
+    registry->add(kFindSuccessor, rpc_recv_find_successor, node);
+    registry->add(kFindSuccessorBatch, rpc_recv_find_successor_batch, node);
+    registry->add(kFindNextHop, rpc_recv_find_next_hop, node);
+    registry->add(kNotify, rpc_recv_notify, node);
+    registry->add(kGetPredecessor, rpc_recv_get_predecessor, node);
+    registry->add(kCheckPredecessor, rpc_recv_check_predecessor, node);
+    registry->add(kGetSuccessorList, rpc_recv_get_successor_list, node);
+}
+
+void rpc_dispatch(Session* session, uint8_t version, const uint8_t* binary, size_t size,
+                  const RpcRegistry& registry) {
+    google::protobuf::Arena& arena = worker_arena();
+    ArenaScope scope(&arena);
+
+    protocol::Request* request = google::protobuf::Arena::CreateMessage<protocol::Request>(&arena);
+    bool parsed;
+    if (version == kEnvelopeVersion) {
+        parsed = request->ParseFromArray(binary, size);
+    } else {
+        // an older peer, a body that does not unwrap is refused below
+        protocol::Call* call = google::protobuf::Arena::CreateMessage<protocol::Call>(&arena);
+        parsed               = call->ParseFromArray(binary, size);
+        if (parsed) {
+            envelope_from_call(*call, request);
+        }
+    }
+    if (!parsed) {
+        LOG(WARNING) << "Malformed call";
+        return;
+    }
+
+    // unknown calls are answered with a failure rather than left hanging
+    protocol::Response* response = google::protobuf::Arena::CreateMessage<protocol::Response>(&arena);
+    if (!registry.dispatch(*request, response)) {
+        LOG(WARNING) << "Unknown or malformed call to method " << request->body_case();
+        response->set_success(false);
+    }
+    response->set_id(request->id());
+
+    // reused by every reply of this worker, it keeps its capacity
+    thread_local std::string packed_ret;
+    if (version == kEnvelopeVersion) {
+        Vivaldi::Instance().local().toProto(response->mutable_coord());
+        CHECK_EQ(response->SerializeToString(&packed_ret), true);
+    } else {
+        // answered in the envelope it came in, the Return announces the newer one
+        protocol::Return* ret = google::protobuf::Arena::CreateMessage<protocol::Return>(&arena);
+        envelope_to_return(*response, ret);
+        CHECK_EQ(ret->SerializeToString(&packed_ret), true);
+        version = kLegacyEnvelope;
+    }
+    session->send(packed_ret, version);
+}
 
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(server_sockfd, &readfds);
+void rpc_daemon(int32_t server_sockfd, chord::Node* node) {
+    RpcRegistry registry;
+    rpc_register(&registry, node);
 
+    // the workers serve whichever call is due when they get to it, not the one that came with their task
+    FairQueue<QueuedCall> calls;
     threadpool pool(kPoolSize);
-    size_t max_sd = server_sockfd;
-    while (1) {
-        if (select(max_sd + 1, &readfds, NULL, NULL, NULL) < 0) {
-            LOG(WARNING) << "select() failed";
+
+    // the reactor only moves bytes and sorts calls, they are parsed and served by the pool
+    Reactor reactor(server_sockfd, [&calls, &pool, &registry](const std::shared_ptr<Session>& session,
+                                                              uint8_t version, BufferPool::Buffer&& frame) {
+        uint64_t id;
+        uint32_t method;
+        bool maintenance = peek_call(version, *frame, &id, &method) && is_maintenance(method);
+
+        // past the threshold a lookup is cheaper to refuse than to queue behind the others, and the
+        // reactor must not wait for room in the pool either
+        ServerStats& stats = server_stats();
+        int64_t depth      = stats.queued.load(std::memory_order_relaxed);
+        if (!maintenance && (depth >= kShedQueueDepth || pool.Full()) && id != 0) {
+            shed(session.get(), version, id, depth);
+            return;
         }
-        if (FD_ISSET(server_sockfd, &readfds)) {
-            client_len    = sizeof(client_addr);
-            client_sockfd = accept(server_sockfd, (struct sockaddr*)&client_addr, &client_len);
-            if (client_sockfd < 0) {
-                continue;
-            } else {
-                LOG(INFO) << "Recieved connection from " << inet_ntoa(client_addr.sin_addr);
-                uint8_t* proto_buff;
-                uint64_t proto_size = recv_proto(client_sockfd, &proto_buff);
-                protocol::Call call;
-                CHECK_EQ(call.ParseFromArray(proto_buff, proto_size), true);
-
-                if (call.name() == kFindSuccessor) {
-                    std::string binary = call.args();
-                    protocol::FindSuccessorArgs args;
-                    CHECK_EQ(args.ParseFromString(binary), true);
-                    pool.AddTask([&] { rpc_recv_find_successor(client_sockfd, args, node); });
-                } else if (call.name() == kNotify) {
-                    std::string binary = call.args();
-                    protocol::NotifyArgs args;
-                    CHECK_EQ(args.ParseFromString(binary), true);
-                    rpc_recv_notify(client_sockfd, args, node);
-                } else if (call.name() == kGetPredecessor) {
-                    pool.AddTask([&] { rpc_recv_get_predecessor(client_sockfd, node); });
-                } else if (call.name() == kGetSuccessorList) {
-                } else if (call.name() == kCheckPredecessor) {
-                    pool.AddTask([&] { rpc_recv_check_predecessor(client_sockfd); });
-                }
-                free(proto_buff);
-            }
+        raise_to(&stats.max_queued, ++stats.queued);
+
+        // maintenance goes ahead of everything, lookups take turns by connection
+        QueuedCall call{session, version, std::move(frame), maintenance};
+        if (maintenance) {
+            calls.pushUrgent(std::move(call));
+        } else {
+            calls.push(reinterpret_cast<uintptr_t>(session.get()), std::move(call));
         }
-    }
-    close(client_sockfd);
+        // a worker serves calls until none is left, so should the pool be full, the tasks
+        // already queued there pick this call up as well
+        pool.TryAddTask([&calls, &registry, &stats] {
+            QueuedCall call;
+            while (calls.pop(&call)) {
+                --stats.queued;
+                rpc_dispatch(call.session.get(), call.version, (const uint8_t*)call.frame->data(),
+                             call.frame->size(), registry);
+                ++(call.maintenance ? stats.maintenance : stats.served);
+            }
+        });
+    });
+    reactor.run();
 }
 
 }  // namespace chord
@@ -1,20 +1,103 @@
 #pragma once
 
+#include "common/channel.h"
+#include "common/coro.h"
+#include "common/reactor.h"
+#include "common/rpc_registry.h"
 #include "node.h"
 
 namespace chord {
+
+/**
+ * \brief  numeric ids of the RPC methods. They index the dispatch table and
+ *         are the field numbers of the methods in the Request and Response
+ *         oneofs, so they never change.
+ */
+enum Method : uint32_t {
+    kFindSuccessor = 1,
+    kFindSuccessorBatch,
+    kFindNextHop,
+    kNotify,
+    kGetPredecessor,
+    kCheckPredecessor,
+    kGetSuccessorList,
+};
+
+/**
+ * \brief  true for the methods that keep the ring healthy: they are never
+ *         shed, whatever the load.
+ */
+inline bool is_maintenance(uint32_t method) {
+    return method == kNotify || method == kGetPredecessor || method == kCheckPredecessor ||
+           method == kGetSuccessorList;
+}
+
+/*! \brief counters of the RPC server of this process. */
+struct ServerStats
+{
+    // calls admitted and not yet picked up by a worker, and the most there were
+    std::atomic<int64_t> queued{0};
+    std::atomic<int64_t> max_queued{0};
+    // lookups and maintenance calls served
+    std::atomic<uint64_t> served{0};
+    std::atomic<uint64_t> maintenance{0};
+    // calls answered busy instead of being queued
+    std::atomic<uint64_t> shed{0};
+};
+
+ServerStats& server_stats();
+
+/**
+ * \brief  serves RPCs on server_sockfd. Maintenance calls are served ahead
+ *         of lookups, and lookups take turns by connection, so neither a
+ *         lookup flood nor one noisy caller holds up the others. Once
+ *         kShedQueueDepth calls wait for a worker, lookups are answered busy
+ *         right away, with a backoff that grows with the queue.
+ */
 void rpc_daemon(int32_t server_sockfd, chord::Node* node);
+void rpc_register(RpcRegistry* registry, chord::Node* node);
+void rpc_dispatch(Session* session, uint8_t version, const uint8_t* binary, size_t size,
+                  const RpcRegistry& registry);
+
+bool rpc_send_check_predecessor(Channel* channel);
+bool rpc_recv_check_predecessor(const protocol::CheckPredecessorArgs& args, chord::Node* node,
+                                protocol::CheckPredecessorRet* ret);
+
+bool rpc_send_find_successor(Channel* channel, const NodeId& id, NodeRef* succ, NodeRef* pred);
+uint64_t rpc_send_find_successor_async(Channel* channel, const NodeId& id,
+                                       std::function<void(bool ok, const NodeRef& succ, const NodeRef& pred)> done);
+bool rpc_recv_find_successor(const protocol::FindSuccessorArgs& args, chord::Node* node,
+                             protocol::FindSuccessorRet* ret);
+
+bool rpc_send_find_successor_batch(Channel* channel, const std::vector<NodeId>& ids, std::vector<NodeRef>* succs);
+bool rpc_recv_find_successor_batch(const protocol::FindSuccessorBatchArgs& args, chord::Node* node,
+                                   protocol::FindSuccessorBatchRet* ret);
+
+uint64_t rpc_send_find_next_hop_async(Channel* channel, const NodeId& id, uint32_t count,
+                                      std::function<void(bool ok, protocol::FindNextHopRet* hop)> done);
+bool rpc_recv_find_next_hop(const protocol::FindNextHopArgs& args, chord::Node* node, protocol::FindNextHopRet* ret);
 
-bool rpc_send_check_predecessor(int32_t peer_sockfd);
-void rpc_recv_check_predecessor(int32_t peer_sockfd);
+bool rpc_send_get_predecessor(Channel* channel, NodeRef* pred);
+bool rpc_recv_get_predecessor(const protocol::GetPredecessorArgs& args, chord::Node* node,
+                              protocol::GetPredecessorRet* ret);
 
-bool rpc_send_find_successor(int32_t peer_sockfd, chord::Node* node);
-void rpc_recv_find_successor(int32_t peer_sockfd, const protocol::FindSuccessorArgs& args, chord::Node* node);
+bool rpc_send_notify(Channel* channel, const NodeRef& self);
+bool rpc_recv_notify(const protocol::NotifyArgs& args, chord::Node* node, protocol::NotifyRet* ret);
 
-bool rpc_send_get_predecessor(int32_t peer_sockfd, chord::Node* node);
-void rpc_recv_get_predecessor(int32_t peer_sockfd, chord::Node* node);
+bool rpc_send_get_successor_list(Channel* channel, const NodeId& self, std::vector<NodeRef>* succs);
+bool rpc_recv_get_successor_list(const protocol::GetSuccessorListArgs& args, chord::Node* node,
+                                 protocol::GetSuccessorListRet* ret);
 
-bool rpc_send_notify(int32_t peer_sockfd, chord::Node* node);
-void rpc_recv_notify(int32_t peer_sockfd, const protocol::NotifyArgs& args, chord::Node* node);
+#ifdef CHORD_WITH_COROUTINES
+// the same requests for coroutines, they suspend the caller instead of blocking it
+Task<bool> rpc_send_find_successor_co(std::shared_ptr<Channel> channel, NodeId id, NodeRef* succ, NodeRef* pred);
+Task<bool> rpc_send_find_successor_batch_co(std::shared_ptr<Channel> channel, std::vector<NodeId> ids,
+                                            std::vector<NodeRef>* succs);
+Task<bool> rpc_send_get_predecessor_co(std::shared_ptr<Channel> channel, NodeRef* pred);
+Task<bool> rpc_send_notify_co(std::shared_ptr<Channel> channel, NodeRef self);
+Task<bool> rpc_send_check_predecessor_co(std::shared_ptr<Channel> channel);
+Task<bool> rpc_send_get_successor_list_co(std::shared_ptr<Channel> channel, NodeId self,
+                                          std::vector<NodeRef>* succs);
+#endif
 
-}  // namespace chord
\ No newline at end of file
+}  // namespace chord
@@ -0,0 +1,105 @@
+#include <math.h>
+
+#include "memory_transport.h"
+#include "rpc.h"
+
+namespace chord {
+
+/**
+ * \brief  a channel to a node of a MemoryTransport. A call completes before
+ *         start() returns, so it never waits and needs no id.
+ */
+class MemoryChannel : public Channel {
+   public:
+    MemoryChannel(MemoryTransport* transport, MemoryTransport::Endpoint* peer) : transport_(transport), peer_(peer) {}
+
+   protected:
+    uint64_t start(protocol::Request& request, PendingCall* pending) override {
+        pending->method = request.body_case();
+        // a host that went down does not refuse the call, it times out and leaves the channel open
+        pending->done(transport_->deliver(peer_, request, pending->response));
+        return 0;
+    }
+
+   private:
+    MemoryTransport* transport_;
+    MemoryTransport::Endpoint* peer_;
+};
+
+MemoryTransport::MemoryTransport(uint32_t seed, double span_ms, double access_ms, double timeout_ms)
+    : random_(seed),
+      span_(span_ms),
+      access_(access_ms),
+      timeout_(timeout_ms),
+      current_(nullptr),
+      elapsed_(0),
+      timeouts_(0) {}
+
+void MemoryTransport::add(Node* node) {
+    std::uniform_real_distribution<double> coordinate(0, span_);
+    std::uniform_real_distribution<double> access(0, access_);
+
+    std::unique_ptr<Endpoint> endpoint(new Endpoint);
+    rpc_register(&endpoint->registry, node);
+    endpoint->x      = coordinate(random_);
+    endpoint->y      = coordinate(random_);
+    endpoint->access = access(random_);
+    endpoint->alive  = true;
+
+    auto& slot = endpoints_[peer_key(node->self.address)];
+    CHECK(slot == nullptr) << "Address " << node->getAddr() << ":" << node->getPort() << " is taken";
+    slot = std::move(endpoint);
+}
+
+void MemoryTransport::fail(const struct sockaddr_in& addr) {
+    auto it = endpoints_.find(peer_key(addr));
+    if (it != endpoints_.end()) {
+        // the registry calls into the node, which may be gone
+        it->second->alive    = false;
+        it->second->registry = RpcRegistry();
+    }
+}
+
+std::shared_ptr<Channel> MemoryTransport::connect(const struct sockaddr_in& addr) {
+    auto it = endpoints_.find(peer_key(addr));
+    if (it == endpoints_.end()) {
+        return nullptr;
+    }
+    if (!it->second->alive) {
+        // the SYN goes unanswered as well
+        ++timeouts_;
+        elapsed_ += timeout_;
+        return nullptr;
+    }
+    return std::make_shared<MemoryChannel>(this, it->second.get());
+}
+
+bool MemoryTransport::deliver(Endpoint* to, const protocol::Request& request, protocol::Response* response) {
+    if (!to->alive) {
+        ++timeouts_;
+        elapsed_ += timeout_;
+        return false;
+    }
+    uint32_t method = request.body_case();
+    if (method >= calls_.size()) {
+        calls_.resize(method + 1);
+    }
+    ++calls_[method];
+    elapsed_ += rtt(current_, to);
+
+    // the handler runs as the callee, its own calls leave from there
+    Endpoint* caller = current_;
+    current_         = to;
+    to->registry.dispatch(request, response);
+    current_ = caller;
+    return true;
+}
+
+double MemoryTransport::rtt(const Endpoint* a, const Endpoint* b) const {
+    if (a == nullptr || a == b) {
+        return 0;
+    }
+    return hypot(a->x - b->x, a->y - b->y) + a->access + b->access;
+}
+
+}  // namespace chord
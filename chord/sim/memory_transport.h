@@ -0,0 +1,100 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "common/connection_pool.h"
+#include "common/rpc_registry.h"
+#include "common/transport.h"
+#include "node.h"
+
+namespace chord {
+
+/**
+ * \brief  a network of nodes in one process. A call is handed to the
+ *         handler of the peer right away, on the calling thread, so a
+ *         recursive lookup runs as nested calls down its path and every node
+ *         can live on a single thread.
+ *
+ *         No time passes during a call. Instead every node sits at a point
+ *         of a plane, drawn from the seed, with an access link of its own,
+ *         and each call adds the RTT between caller and callee to elapsed():
+ *         summed along the nested calls of a lookup, that is its latency. A
+ *         call to a node that failed costs timeout_ms and fails.
+ * \note   not thread-safe, every call must come from the same thread.
+ */
+class MemoryTransport : public Transport {
+   public:
+    /*! \brief nodes are spread over a span_ms square, access links take up to access_ms. */
+    MemoryTransport(uint32_t seed, double span_ms, double access_ms, double timeout_ms);
+
+    /*! \brief puts node on the network at its address, answering the methods of rpc_register(). */
+    void add(Node* node);
+
+    /*! \brief the node at addr stops answering, as if its host went down. */
+    void fail(const struct sockaddr_in& addr);
+
+    std::shared_ptr<Channel> connect(const struct sockaddr_in& addr) override;
+
+    /*! \brief runs f() as node, the calls f makes leave from it. */
+    template <typename F>
+    void as(const Node* node, F&& f);
+
+    /*! \brief ms accounted to calls so far. */
+    double elapsed() const { return elapsed_; }
+
+    /*! \brief calls of method that reached a live node, and calls that found a failed one. */
+    uint64_t calls(uint32_t method) const { return method < calls_.size() ? calls_[method] : 0; }
+    uint64_t timeouts() const { return timeouts_; }
+
+    MemoryTransport(const MemoryTransport&) = delete;
+    MemoryTransport& operator=(const MemoryTransport&) = delete;
+
+   private:
+    friend class MemoryChannel;
+
+    struct Endpoint
+    {
+        RpcRegistry registry;
+        double x;
+        double y;
+        double access;
+        bool alive;
+    };
+
+    /**
+     * \brief  runs request on the node at to, as called from the current node.
+     * \return false if that node failed.
+     */
+    bool deliver(Endpoint* to, const protocol::Request& request, protocol::Response* response);
+
+    double rtt(const Endpoint* a, const Endpoint* b) const;
+
+    std::mt19937 random_;
+    double span_;
+    double access_;
+    double timeout_;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Endpoint>> endpoints_;
+    // the node whose code is running, calls leave from it
+    Endpoint* current_;
+
+    double elapsed_;
+    std::vector<uint64_t> calls_;
+    uint64_t timeouts_;
+};
+
+template <typename F>
+void MemoryTransport::as(const Node* node, F&& f) {
+    Endpoint* caller = current_;
+    auto it          = endpoints_.find(peer_key(node->self.address));
+    current_         = it == endpoints_.end() ? nullptr : it->second.get();
+    f();
+    current_ = caller;
+}
+
+}  // namespace chord
@@ -0,0 +1,419 @@
+// Runs a Chord ring of many nodes in one process: the nodes are the Node of
+// the daemon, their calls go over MemoryTransport and their maintenance tasks
+// run on a VirtualClock, all on this thread, so a run only depends on the
+// seed. After a warmup the ring serves lookups while stable, then goes
+// through churn, nodes failing and joining while lookups go on, and the
+// report has the hops and latency of the lookups of either phase and how long
+// the ring took to converge again once churn stopped.
+//
+//   ./chord_sim --nodes 10000 --seed 1 --lookups 10000 --churn 1000
+
+#include <arpa/inet.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/adaptive_interval.h"
+#include "common/connection_pool.h"
+#include "common/cxxopts.h"
+#include "common/node_ref.h"
+#include "memory_transport.h"
+#include "node.h"
+#include "rpc.h"
+#include "virtual_clock.h"
+
+namespace {
+
+/*! \brief the port every simulated node listens on, nodes differ by address. */
+const uint16_t kSimPort = 4000;
+
+/*! \brief the first address handed out, 10.0.0.1. */
+const uint32_t kFirstAddress = (10u << 24) + 1;
+
+/*! \brief sorted samples of one measure, summarized by percentiles. */
+class Samples {
+   public:
+    void add(double value) { values_.push_back(value); }
+
+    size_t size() const { return values_.size(); }
+
+    void print(const char* what) {
+        std::sort(values_.begin(), values_.end());
+        double sum = 0;
+        for (auto v : values_) {
+            sum += v;
+        }
+        printf("  %-12s mean %8.2f  p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f\n", what,
+               values_.empty() ? 0 : sum / values_.size(), at(0.5), at(0.9), at(0.99), at(1));
+    }
+
+   private:
+    double at(double q) const {
+        if (values_.empty()) {
+            return 0;
+        }
+        return values_[std::min(values_.size() - 1, size_t(q * values_.size()))];
+    }
+
+    std::vector<double> values_;
+};
+
+/*! \brief the lookups of one phase. */
+struct Phase
+{
+    Phase() : failed(0), wrong(0) {}
+
+    void print(const char* name) {
+        printf("%s: %zu lookups, %llu failed, %llu wrong owner\n", name, hops.size(), (unsigned long long)failed,
+               (unsigned long long)wrong);
+        hops.print("hops");
+        latency.print("latency ms");
+        timeouts.print("timeouts");
+    }
+
+    Samples hops;
+    Samples latency;
+    Samples timeouts;
+    uint64_t failed;
+    uint64_t wrong;
+};
+
+/*! \brief reads min:max or a fixed period in ms, as the daemon does. */
+void parse_interval(const std::string& value, chord::AdaptiveInterval* interval) {
+    char* end = nullptr;
+    long min  = strtol(value.c_str(), &end, 10);
+    long max  = *end == ':' ? strtol(end + 1, &end, 10) : min;
+    CHECK(*end == '\0' && min >= 1 && min <= max) << "Invalid period: " << value;
+    interval->setBounds(min, max);
+}
+
+class Simulation {
+   public:
+    explicit Simulation(const cxxopts::ParseResult& flags)
+        : flags_(flags),
+          network_(flags["seed"].as<uint32_t>(), flags["span"].as<double>(), flags["access"].as<double>(),
+                   flags["timeout"].as<double>()),
+          random_(flags["seed"].as<uint32_t>()),
+          next_address_(kFirstAddress),
+          joined_(0),
+          failed_(0) {
+        chord::ConnectionPool::Instance().setTransport(&network_);
+    }
+
+    /**
+     * \brief  puts up count nodes with the routing state the protocol
+     *         converges to, as if the ring had been running for long.
+     */
+    void bootstrap(size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            chord::Node* node = spawn();
+            auto at           = std::lower_bound(ring_.begin(), ring_.end(), node->self.id, Member::Before());
+            CHECK(at == ring_.end() || at->node->self.id != node->self.id) << "Two nodes share an id";
+            ring_.insert(at, Member(node));
+        }
+        for (auto& m : ring_) {
+            chord::Node* node = m.node;
+            node->routing.update([this, node](chord::RoutingState& state) {
+                state.predecessor = predecessor(node->self.id)->self;
+                state.succ_list.clear();
+                auto it = successor(node->self.id);
+                for (int32_t k = 0; k < node->r; ++k) {
+                    it = it + 1 == ring_.end() ? ring_.begin() : it + 1;
+                    state.succ_list.push_back(it->node->self);
+                }
+                state.successor = state.succ_list[0];
+                state.fingers.reset(node->self);
+                for (size_t i = 0; i < chord::kFingers; ++i) {
+                    state.fingers.set(i, owner(state.fingers.start(i)));
+                }
+                return true;
+            });
+        }
+        for (auto& m : ring_) {
+            start(m.node);
+        }
+    }
+
+    /*! \brief a new node joins through a random live one. */
+    void join() {
+        chord::Node* node  = spawn();
+        node->join_address = pick()->self.address;
+        network_.as(node, [node] {
+            node->join();
+            node->initFingers();
+        });
+        auto at = std::lower_bound(ring_.begin(), ring_.end(), node->self.id, Member::Before());
+        ring_.insert(at, Member(node));
+        start(node);
+        ++joined_;
+    }
+
+    /*! \brief a random live node fails without a word. */
+    void fail() {
+        if (ring_.size() <= 2) {
+            return;
+        }
+        auto it = ring_.begin() + std::uniform_int_distribution<size_t>(0, ring_.size() - 1)(random_);
+        for (int id : timers_[it->node]) {
+            clock_.cancel(id);
+        }
+        timers_.erase(it->node);
+        network_.fail(it->node->self.address);
+        delete it->node;
+        ring_.erase(it);
+        ++failed_;
+    }
+
+    /*! \brief a random live node looks up a random id, and phase learns how that went. */
+    void lookup(Phase* phase) {
+        chord::NodeId id;
+        for (auto& b : id.bytes) {
+            b = random_();
+        }
+        chord::Node* origin = pick();
+
+        double elapsed    = network_.elapsed();
+        uint64_t hops     = network_.calls(chord::kFindSuccessor);
+        uint64_t timeouts = network_.timeouts();
+        chord::NodeRef found;
+        network_.as(origin, [origin, &id, &found] { found = origin->findSuccessor(id); });
+
+        phase->hops.add(network_.calls(chord::kFindSuccessor) - hops);
+        phase->latency.add(network_.elapsed() - elapsed);
+        phase->timeouts.add(network_.timeouts() - timeouts);
+        if (!found.valid()) {
+            ++phase->failed;
+        } else if (found.id != owner(id).id) {
+            ++phase->wrong;
+        }
+    }
+
+    /*! \brief true once every live node has its true successor and predecessor. */
+    bool converged() {
+        for (size_t i = 0; i < ring_.size(); ++i) {
+            auto state = ring_[i].node->routing.read();
+            if (state->successor.id != ring_[(i + 1) % ring_.size()].node->self.id ||
+                state->predecessor.id != ring_[(i + ring_.size() - 1) % ring_.size()].node->self.id) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    chord::VirtualClock& clock() { return clock_; }
+    size_t size() const { return ring_.size(); }
+    uint64_t joined() const { return joined_; }
+    uint64_t failed() const { return failed_; }
+    uint64_t calls() const {
+        uint64_t calls = 0;
+        for (uint32_t method = chord::kFindSuccessor; method <= chord::kGetSuccessorList; ++method) {
+            calls += network_.calls(method);
+        }
+        return calls;
+    }
+
+   private:
+    struct Member
+    {
+        explicit Member(chord::Node* node) : node(node) {}
+
+        struct Before
+        {
+            bool operator()(const Member& m, const chord::NodeId& id) const { return m.node->self.id < id; }
+        };
+
+        chord::Node* node;
+    };
+
+    /*! \brief a node at the next free address, on the network but not yet in the ring. */
+    chord::Node* spawn() {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(next_address_++);
+        address.sin_port        = htons(kSimPort);
+
+        // id = hash(ip:port), as the daemon makes it
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+        std::string ip_port = std::string(ip) + ":" + std::to_string(kSimPort);
+        chord::NodeId id;
+        SHA1((const uint8_t*)ip_port.c_str(), ip_port.size(), id.data());
+
+        chord::Node* node      = new chord::Node();
+        node->self             = chord::NodeRef(id, address);
+        node->r                = flags_["r"].as<int32_t>();
+        node->iterative        = false;
+        node->alpha            = 1;
+        node->parallel_batches = false;
+        parse_interval(flags_["ts"].as<std::string>(), &node->tv_stabilize);
+        parse_interval(flags_["tff"].as<std::string>(), &node->tv_fix_fingers);
+        parse_interval(flags_["tcp"].as<std::string>(), &node->tv_check_predecessor);
+        network_.add(node);
+        return node;
+    }
+
+    /**
+     * \brief  starts the maintenance tasks of node as the daemon does, at a
+     *         random offset within their first period so that the nodes do
+     *         not all run them at the same ms.
+     */
+    void start(chord::Node* node) {
+        int32_t offset = std::uniform_int_distribution<int32_t>(0, node->tv_fix_fingers.current())(random_);
+        timers_[node].push_back(clock_.create("start", offset, false, [this, node] {
+            periodic(node, "fixFingers", &node->tv_fix_fingers, [node] { node->fixFingers(); });
+            periodic(node, "checkPredecessor", &node->tv_check_predecessor, [node] { node->checkPredecessor(); });
+            periodic(node, "stabilize", &node->tv_stabilize, [node] { node->stabilize(); });
+        }));
+    }
+
+    template <typename F>
+    void periodic(chord::Node* node, const std::string& name, chord::AdaptiveInterval* interval, F f) {
+        int id = clock_.create(name, interval->current(), true, [this, node, f] { network_.as(node, f); });
+        interval->setListener([this, id](int32_t interval_ms) { clock_.setInterval(id, interval_ms); });
+        timers_[node].push_back(id);
+    }
+
+    /*! \brief a random live node. */
+    chord::Node* pick() {
+        return ring_[std::uniform_int_distribution<size_t>(0, ring_.size() - 1)(random_)].node;
+    }
+
+    /*! \brief the first live node at or after id, and the last one before it. */
+    std::vector<Member>::iterator successor(const chord::NodeId& id) {
+        auto it = std::lower_bound(ring_.begin(), ring_.end(), id, Member::Before());
+        return it == ring_.end() ? ring_.begin() : it;
+    }
+    chord::Node* predecessor(const chord::NodeId& id) {
+        auto it = std::lower_bound(ring_.begin(), ring_.end(), id, Member::Before());
+        return it == ring_.begin() ? ring_.back().node : (it - 1)->node;
+    }
+
+    /*! \brief the live node that owns id. */
+    const chord::NodeRef& owner(const chord::NodeId& id) { return successor(id)->node->self; }
+
+    const cxxopts::ParseResult& flags_;
+    chord::VirtualClock clock_;
+    chord::MemoryTransport network_;
+    std::mt19937 random_;
+    uint32_t next_address_;
+    uint64_t joined_;
+    uint64_t failed_;
+
+    // the live nodes by id, and the timers of each
+    std::vector<Member> ring_;
+    std::unordered_map<chord::Node*, std::vector<int>> timers_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options("chord_sim", "Simulates a Chord ring of many nodes in one process");
+
+    // clang-format off
+    options.add_options("Simulation")
+        ("nodes",    "The number of nodes in the ring at the start", cxxopts::value<size_t>()->default_value("10000"))
+        ("seed",     "The seed of everything random in the run", cxxopts::value<uint32_t>()->default_value("1"))
+        ("lookups",  "The number of lookups in the stable ring, and as many again under churn", cxxopts::value<size_t>()->default_value("10000"))
+        ("churn",    "The number of nodes that fail or join under churn, either one at even odds", cxxopts::value<size_t>()->default_value("1000"))
+        ("churn_ms", "The ms over which churn is spread", cxxopts::value<int32_t>()->default_value("60000"))
+        ("warmup",   "The ms the ring runs before the stable lookups", cxxopts::value<int32_t>()->default_value("60000"))
+        ("settle",   "The most ms to wait for the ring to converge after churn", cxxopts::value<int32_t>()->default_value("600000"))
+        ("probe",    "The ms between checks whether the ring converged", cxxopts::value<int32_t>()->default_value("100"))
+        ("span",     "The side of the square in ms the nodes are spread over", cxxopts::value<double>()->default_value("150"))
+        ("access",   "The longest delay in ms of the access link of a node", cxxopts::value<double>()->default_value("10"))
+        ("timeout",  "The ms a call to a failed node costs", cxxopts::value<double>()->default_value("1000"))
+        ("ts",       "The time in milliseconds between invocations of 'stabilize', or min:max to adapt it to churn", cxxopts::value<std::string>()->default_value("1000:30000"))
+        ("tff",      "The time in milliseconds between invocations of 'fix fingers', or min:max to adapt it to churn", cxxopts::value<std::string>()->default_value("100:10000"))
+        ("tcp",      "The time in milliseconds between invocations of 'check predecessor', or min:max to adapt it to churn", cxxopts::value<std::string>()->default_value("1000:30000"))
+        ("r",        "The number of successors to maintain", cxxopts::value<int32_t>()->default_value("3"))
+        ("h,help",   "Print help")
+        ("v",        "Enable verbose");
+    // clang-format on
+
+    auto flags = options.parse(argc, argv);
+    if (flags.count("help")) {
+        std::cout << options.help({"Simulation"}) << std::endl;
+        return 0;
+    }
+    if (!flags.count("v")) {
+        // thousands of nodes warn about every failure they run into
+        FLAGS_minloglevel = google::GLOG_ERROR;
+    }
+    CHECK_GE(flags["nodes"].as<size_t>(), 2u) << "A ring needs at least 2 nodes";
+    CHECK_GE(flags["r"].as<int32_t>(), 1) << "The number of successors maintained must be at least 1";
+    CHECK_LT(flags["r"].as<int32_t>(), (int32_t)flags["nodes"].as<size_t>())
+        << "The number of successors maintained must be less than the number of nodes";
+
+    auto wall = std::chrono::steady_clock::now();
+    Simulation sim(flags);
+    chord::VirtualClock& clock = sim.clock();
+
+    sim.bootstrap(flags["nodes"].as<size_t>());
+    clock.run(flags["warmup"].as<int32_t>());
+
+    Phase stable;
+    for (size_t i = 0; i < flags["lookups"].as<size_t>(); ++i) {
+        sim.lookup(&stable);
+    }
+
+    // churn events and lookups spread evenly over churn_ms
+    Phase churn;
+    std::mt19937 coin(flags["seed"].as<uint32_t>());
+    int64_t churn_start = clock.now();
+    int64_t churn_end   = churn_start + flags["churn_ms"].as<int32_t>();
+    size_t events       = flags["churn"].as<size_t>();
+    size_t lookups      = flags["lookups"].as<size_t>();
+    for (size_t i = 0; i < events; ++i) {
+        int32_t at = (i + 1) * flags["churn_ms"].as<int32_t>() / (events + 1);
+        clock.create("churn", at, false, [&sim, &coin] {
+            if (coin() & 1) {
+                sim.fail();
+            } else {
+                sim.join();
+            }
+        });
+    }
+    for (size_t i = 0; i < lookups; ++i) {
+        int32_t at = (i + 1) * flags["churn_ms"].as<int32_t>() / (lookups + 1);
+        clock.create("lookup", at, false, [&sim, &churn] { sim.lookup(&churn); });
+    }
+    clock.run(churn_end);
+
+    // the first probe that finds the ring right
+    int64_t converged = -1;
+    int32_t probe     = flags["probe"].as<int32_t>();
+    int probes        = clock.create("probe", probe, true, [&sim, &clock, &converged] {
+        if (converged < 0 && sim.converged()) {
+            converged = clock.now();
+        }
+    });
+    for (int64_t until = churn_end; converged < 0 && until < churn_end + flags["settle"].as<int32_t>();) {
+        until += probe;
+        clock.run(until);
+    }
+    clock.cancel(probes);
+
+    printf("%zu nodes at the start, seed %u, %llu failed and %llu joined over %d ms\n\n",
+           flags["nodes"].as<size_t>(), flags["seed"].as<uint32_t>(), (unsigned long long)sim.failed(),
+           (unsigned long long)sim.joined(), flags["churn_ms"].as<int32_t>());
+    stable.print("stable");
+    churn.print("churn");
+    if (converged < 0) {
+        printf("\nnot converged %d ms after churn\n", flags["settle"].as<int32_t>());
+    } else {
+        printf("\nconverged %lld ms after churn, %zu nodes\n", (long long)(converged - churn_end), sim.size());
+    }
+    printf("%llu calls in %lld ms of virtual time, %.1f s of wall time\n", (unsigned long long)sim.calls(),
+           (long long)clock.now(),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count());
+    clock.report(std::cout);
+    return converged < 0 ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#include <algorithm>
+
+#include "virtual_clock.h"
+
+namespace chord {
+
+int VirtualClock::add(const std::string& name, int interval_ms, bool repeat, std::function<void()> handler) {
+    int id           = nextId_++;
+    Timer& timer     = timers_[id];
+    timer.name       = name;
+    timer.interval   = std::max(1, interval_ms);
+    timer.repeat     = repeat;
+    timer.handler    = std::move(handler);
+    timer.due        = now_ + timer.interval;
+    timer.generation = 0;
+    file(id, &timer);
+    return id;
+}
+
+bool VirtualClock::cancel(int id) {
+    // its entry in the queue is dropped when it comes up
+    return timers_.erase(id) == 1;
+}
+
+bool VirtualClock::setInterval(int id, int interval_ms) {
+    auto it = timers_.find(id);
+    if (it == timers_.end()) {
+        return false;
+    }
+    Timer& timer   = it->second;
+    timer.interval = std::max(1, interval_ms);
+    if (now_ + timer.interval < timer.due) {
+        timer.due = now_ + timer.interval;
+        file(id, &timer);
+    }
+    return true;
+}
+
+void VirtualClock::run(int64_t until) {
+    while (!queue_.empty() && queue_.top().first.first <= until) {
+        Entry entry = queue_.top();
+        queue_.pop();
+        auto it = timers_.find(entry.second.first);
+        if (it == timers_.end() || it->second.generation != entry.second.second) {
+            continue;
+        }
+
+        now_         = entry.first.first;
+        Timer& timer = it->second;
+        ++runs_[timer.name];
+        // the handler may cancel its own timer, it runs from a copy
+        std::function<void()> handler = timer.handler;
+        if (timer.repeat) {
+            timer.due = now_ + timer.interval;
+            file(entry.second.first, &timer);
+        } else {
+            timers_.erase(it);
+        }
+        handler();
+    }
+    now_ = std::max(now_, until);
+}
+
+void VirtualClock::file(int id, Timer* timer) {
+    queue_.push(Entry(std::make_pair(timer->due, filed_++), std::make_pair(id, ++timer->generation)));
+}
+
+void VirtualClock::report(std::ostream& out) {
+    for (auto& runs : runs_) {
+        out << "< Timer " << runs.first << " " << runs.second << " runs" << std::endl;
+    }
+}
+
+}  // namespace chord
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace chord {
+
+/**
+ * \brief  the timers of TimerWheel on a clock that only moves when told to.
+ *         run() jumps from one due timer to the next and runs it on the
+ *         calling thread, timers due at the same ms in the order they were
+ *         filed, so a run depends on nothing but what the timers do. A
+ *         handler takes no time, and may create, cancel and change timers.
+ * \note   not thread-safe.
+ */
+class VirtualClock {
+   public:
+    VirtualClock() : now_(0), nextId_(1), filed_(0) {}
+
+    /*! \brief ms since the clock started. */
+    int64_t now() const { return now_; }
+
+    /**
+     * \brief  runs f(args...) in interval_ms, and every interval_ms after
+     *         that if repeat. name identifies the timer in report().
+     * \return the id of the timer, to cancel it.
+     */
+    template <class F, class... Args>
+    int create(const std::string& name, int interval_ms, bool repeat, F&& f, Args&&... args);
+
+    /**
+     * \brief  stops the timer.
+     * \return false if there is no such timer.
+     */
+    bool cancel(int id);
+
+    /**
+     * \brief  changes the period of a repeating timer. A shorter one takes
+     *         effect at once, a longer one after the next run.
+     * \return false if there is no such timer.
+     */
+    bool setInterval(int id, int interval_ms);
+
+    /*! \brief runs every timer due by until, then sets the clock to until. */
+    void run(int64_t until);
+
+    /*! \brief prints how often the timers of every name ran. */
+    void report(std::ostream& out);
+
+    VirtualClock(const VirtualClock&) = delete;
+    VirtualClock& operator=(const VirtualClock&) = delete;
+
+   private:
+    struct Timer
+    {
+        std::string name;
+        int64_t interval;
+        bool repeat;
+        std::function<void()> handler;
+        int64_t due;
+        // the count of times the timer was filed, entries holding an older count are stale
+        uint64_t generation;
+    };
+
+    // due, filing order, id and generation, the earliest first
+    typedef std::pair<std::pair<int64_t, uint64_t>, std::pair<int, uint64_t>> Entry;
+
+    int add(const std::string& name, int interval_ms, bool repeat, std::function<void()> handler);
+
+    /*! \brief files timer id under its due ms. */
+    void file(int id, Timer* timer);
+
+    int64_t now_;
+    int nextId_;
+    uint64_t filed_;
+    std::map<int, Timer> timers_;
+    std::map<std::string, uint64_t> runs_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+};
+
+template <class F, class... Args>
+int VirtualClock::create(const std::string& name, int interval_ms, bool repeat, F&& f, Args&&... args) {
+    std::function<void()> handler = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    return add(name, interval_ms, repeat, std::move(handler));
+}
+
+}  // namespace chord
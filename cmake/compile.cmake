@@ -16,8 +16,34 @@ if(MSVC)
     endif()
 else(MSVC)
     include(CheckCXXCompilerFlag)
+    include(CheckCXXSourceCompiles)
     CHECK_CXX_COMPILER_FLAG("-std=c++11" SUPPORT_CXX11)
     set(CMAKE_CXX_FLAGS "-Wall -std=c++11 -fPIC")
+
+    # the coroutine RPC client and maintenance tasks need C++20, other
+    # compilers build the blocking ones
+    option(WITH_COROUTINES "Run maintenance as C++20 coroutines where supported" ON)
+    if(WITH_COROUTINES)
+        set(CMAKE_REQUIRED_FLAGS "-std=c++20")
+        CHECK_CXX_SOURCE_COMPILES("
+            #include <coroutine>
+            struct task {
+                struct promise_type {
+                    task get_return_object() { return {}; }
+                    std::suspend_never initial_suspend() noexcept { return {}; }
+                    std::suspend_never final_suspend() noexcept { return {}; }
+                    void return_void() {}
+                    void unhandled_exception() {}
+                };
+            };
+            task f() { co_return; }
+            int main() { f(); return 0; }" SUPPORT_COROUTINES)
+        unset(CMAKE_REQUIRED_FLAGS)
+        if(SUPPORT_COROUTINES)
+            set(CMAKE_CXX_FLAGS "-Wall -std=c++20 -fPIC")
+            add_definitions(-DCHORD_WITH_COROUTINES)
+        endif(SUPPORT_COROUTINES)
+    endif(WITH_COROUTINES)
 endif(MSVC)
 
 #####